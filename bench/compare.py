@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+# Licensed under the MIT License. See LICENSE file in the project root.
+
+"""Compares two results of bench/run.py and flags what got worse.
+
+usage: bench/compare.py baseline.json latest.json [-threshold PERCENT]
+
+A measurement regressed when it grew by more than PERCENT (5 by default) over the baseline. Parse
+times under a millisecond are too short to tell apart, so they only regress past that. Exits with
+1 if anything regressed.
+"""
+
+import json
+import sys
+
+# Measurement, what it is compared by, and how much it must grow by to count at all
+METRICS = [
+    ('ns_per_instruction', 'ns/instr', 0),
+    ('parse_ns', 'parse ns', 1000000),
+    ('peak_rss_kb', 'peak RSS KB', 0),
+]
+
+
+def load(path):
+    with open(path) as f:
+        return {(r['name'], r['mode']): r for r in json.load(f)['results']}
+
+
+def main(args):
+    threshold = 5.0
+    paths = []
+    i = 0
+    while i < len(args):
+        if args[i] == '-threshold':
+            threshold = float(args[i + 1])
+            i += 1
+        else:
+            paths.append(args[i])
+        i += 1
+    if len(paths) != 2:
+        sys.exit(__doc__.strip())
+    baseline, latest = load(paths[0]), load(paths[1])
+
+    regressions = 0
+    print('%-12s %-7s %-12s %14s %14s %8s' % ('benchmark', 'mode', 'measure', 'baseline',
+                                             'latest', 'change'))
+    for key in sorted(latest):
+        if key not in baseline:
+            continue
+        for metric, label, floor in METRICS:
+            old, new = baseline[key][metric], latest[key][metric]
+            if not old or new is None:
+                continue
+            change = (new - old) / old * 100
+            regressed = change > threshold and new - old > floor
+            regressions += regressed
+            print('%-12s %-7s %-12s %14.2f %14.2f %+7.1f%%%s' % (
+                key[0], key[1], label, old, new, change, '  REGRESSION' if regressed else ''))
+    missing = sorted(set(baseline) - set(latest))
+    for name, mode in missing:
+        print('%s %s is missing from the latest results' % (name, mode))
+
+    if regressions:
+        print('%d regression%s over %g%%' % (regressions, '' if regressions == 1 else 's',
+                                             threshold))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+# Licensed under the MIT License. See LICENSE file in the project root.
+
+"""Runs the benchmarks and writes their results as JSON.
+
+usage: bench/run.py [dtvm] [-runs N] [-o path]
+
+Every benchmark runs in each mode, `vm` (-no-tier), `tiered` (the default) and `jit` (-jit), and
+keeps the fastest of N runs (5 by default). Instructions are counted in the `vm` mode, and the
+other modes divide their time by the same count. The results go to stdout, or to `path`.
+"""
+
+import json
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+
+MODES = [
+    ('vm', ['-no-tier']),
+    ('tiered', []),
+    ('jit', ['-jit']),
+]
+
+
+def calculator_input():
+    rng = random.Random(1)
+    count = 200000
+    lines = [str(count)]
+    for _ in range(count):
+        lines.append(str(rng.randint(1, 4)))
+        lines.append(str(rng.randint(1, 1000)))
+        lines.append('%.2f' % rng.uniform(1, 100))
+    return '\n'.join(lines) + '\n'
+
+
+def io_input():
+    rng = random.Random(2)
+    count = 300000
+    return '\n'.join([str(count)] + [str(rng.randint(-10**6, 10**6)) for _ in range(count)]) + '\n'
+
+
+# Name, program and what it reads
+BENCHMARKS = [
+    ('fibonacci', os.path.join(ROOT, 'example', 'fibonacci.dta'), lambda: '30\n'),
+    ('fizzbuzz', os.path.join(HERE, 'fizzbuzz.dta'), lambda: '1000000\n'),
+    ('calculator', os.path.join(HERE, 'calculator.dta'), calculator_input),
+    ('dispatch', os.path.join(HERE, 'dispatch.dta'), lambda: ''),
+    ('arith', os.path.join(HERE, 'arith.dta'), lambda: ''),
+    ('calls', os.path.join(HERE, 'calls.dta'), lambda: ''),
+    ('io', os.path.join(HERE, 'io.dta'), io_input),
+]
+
+
+def run_once(dtvm, program, flags, input_path, report_path):
+    with open(input_path, 'rb') as stdin:
+        done = subprocess.run([dtvm, program, '-bench=' + report_path] + flags, stdin=stdin,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, timeout=600)
+    if done.returncode != 0:
+        sys.exit('%s %s failed:\n%s' % (program, ' '.join(flags), done.stderr.decode()))
+    with open(report_path) as f:
+        return json.load(f)
+
+
+def main(args):
+    dtvm = os.path.join(ROOT, 'dtvm')
+    runs = 5
+    output = None
+    i = 0
+    while i < len(args):
+        if args[i] == '-runs':
+            runs = int(args[i + 1])
+            i += 1
+        elif args[i] == '-o':
+            output = args[i + 1]
+            i += 1
+        else:
+            dtvm = args[i]
+        i += 1
+
+    results = []
+    with tempfile.TemporaryDirectory() as tmp:
+        report_path = os.path.join(tmp, 'report.json')
+        for name, program, make_input in BENCHMARKS:
+            input_path = os.path.join(tmp, name + '.in')
+            with open(input_path, 'w') as f:
+                f.write(make_input())
+            instructions = None
+            for mode, flags in MODES:
+                best = None
+                for _ in range(runs):
+                    r = run_once(dtvm, program, flags, input_path, report_path)
+                    if best is None:
+                        best = r
+                    else:
+                        for key in ('parse_ns', 'run_ns', 'peak_rss_kb'):
+                            best[key] = min(best[key], r[key])
+                if best['instructions']:
+                    instructions = best['instructions']
+                results.append({
+                    'name': name,
+                    'mode': mode,
+                    'instructions': instructions,
+                    'parse_ns': best['parse_ns'],
+                    'run_ns': best['run_ns'],
+                    'ns_per_instruction':
+                        best['run_ns'] / instructions if instructions else None,
+                    'peak_rss_kb': best['peak_rss_kb'],
+                })
+                print('%-12s %-7s %8.2f ns/instr %10.3f ms' % (
+                    name, mode, results[-1]['ns_per_instruction'] or 0, best['run_ns'] / 1e6),
+                    file=sys.stderr)
+
+    text = json.dumps({'runs': runs, 'results': results}, indent=2) + '\n'
+    if output:
+        with open(output, 'w') as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
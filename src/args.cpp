@@ -10,3 +10,18 @@ int dtvm_args::num_regs = 8;
 std::string dtvm_args::entry_point = "_start";
 bool dtvm_args::debug = false;
 bool dtvm_args::show_data = false;
+bool dtvm_args::optimize = false;
+bool dtvm_args::jit = false;
+bool dtvm_args::tiering = true;
+std::string dtvm_args::compile_path = "";
+size_t dtvm_args::stack_size = size_t(1) << 20;
+flush_policy dtvm_args::flush = flush_policy::line;
+unsigned dtvm_args::batch_threads = 0;
+bool dtvm_args::pin_threads = false;
+bool dtvm_args::batch_stats = false;
+std::string dtvm_args::profile_path = "";
+unsigned dtvm_args::sample_hz = 0;
+std::string dtvm_args::bench_path = "";
+std::string dtvm_args::trace_path = "";
+size_t dtvm_args::trace_steps = size_t(1) << 20;
+std::string dtvm_args::show_trace_path = "";
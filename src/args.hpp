@@ -5,6 +5,8 @@
 
 #include <string>
 
+#include "output.hpp"
+
 
 // This namespace holds argument variables globally
 // They should only be written to during the initialization phase of `main`.
@@ -25,6 +27,55 @@ namespace dtvm_args {
 	// "-debug"
 	// Executes with debug mode
 	extern bool debug;
+	// "-jit"
+	// Translates the code to native code and runs that instead of interpreting it
+	extern bool jit;
+	// "-no-tier"
+	// Keeps hot code in the interpreter instead of moving it to native code
+	extern bool tiering;
+	// "-O"
+	// Optimizes the parsed code before executing or printing it
+	extern bool optimize;
+	// "-compile <path>"
+	// Writes the parsed code to <path> in the precompiled format instead of executing it
+	extern std::string compile_path;
+	// "-stack=<entries>"
+	// Capacity of the stack and of the callstack. Defaults to 1048576 entries each.
+	extern size_t stack_size;
+	// "-flush=<policy>"
+	// When program output is written out: at every "line" (the default), when the buffer is
+	// "full", or only at "exit"
+	extern flush_policy flush;
+	// "-threads=<count>"
+	// Number of worker threads in batch mode. Defaults to one per core.
+	extern unsigned batch_threads;
+	// "-pin"
+	// Pins each worker thread to its own core in batch mode
+	extern bool pin_threads;
+	// "-stats"
+	// Reports jobs and instructions run per second at the end of batch mode
+	extern bool batch_stats;
+	// "-profile[=<path>]"
+	// Writes the cycles spent in each label and call path to <path>, "profile.folded" by default,
+	// as collapsed stacks, and a summary by label to stderr
+	extern std::string profile_path;
+	// "-trace=<path>"
+	// Records the last steps run, and writes them to <path> when the program ends
+	extern std::string trace_path;
+	// "-trace-steps=<n>"
+	// Number of steps a trace keeps
+	extern size_t trace_steps;
+	// "-show-trace=<path>"
+	// Prints the trace at <path> instead of running the code
+	extern std::string show_trace_path;
+	// "-bench=<path>"
+	// Writes the time spent parsing and running, the instructions run (with -no-tier) and the
+	// peak memory use to <path> as JSON
+	extern std::string bench_path;
+	// "-sample=<hz>"
+	// Samples the instruction running and the calls <hz> times per second of CPU time, and reports
+	// the hottest instructions and routines to stderr. 0 doesn't sample.
+	extern unsigned sample_hz;
 	// "-show-data"
 	// Also displays data section when printing parsed code
 	extern bool show_data;
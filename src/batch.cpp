@@ -0,0 +1,318 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "batch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "args.hpp"
+#include "dtvm.hpp"
+#include "error.hpp"
+
+
+struct batch_job {
+	const std::shared_ptr<const Code> *code;
+	std::string program;
+	std::string input;
+	std::string output;
+	// Where the job is in the manifest
+	int line_num;
+};
+
+
+// Holds what each thread writes to std::cerr while running jobs, so the messages of a job are
+// written out at once when it ends, under a line naming it, instead of mixing with the messages
+// of jobs on other threads. Every character written goes to a buffer of the calling thread.
+class JobErrors : public std::streambuf {
+private:
+	static thread_local std::string pending;
+	std::streambuf *out;
+	std::mutex lock;
+
+protected:
+	int overflow(int c) override
+	{
+		if (c != traits_type::eof())
+			pending += traits_type::to_char_type(c);
+		return traits_type::not_eof(c);
+	}
+
+	std::streamsize xsputn(const char *s, std::streamsize n) override
+	{
+		pending.append(s, n);
+		return n;
+	}
+
+public:
+	// @arg out - Where the messages are written out in the end
+	explicit JobErrors(std::streambuf *out)
+		: out(out)
+	{
+	}
+
+	std::streambuf *original() const
+	{
+		return out;
+	}
+
+	// Writes out the messages of the calling thread's last job, in a single call. If it failed,
+	// `header` says which job it was, even if it wrote nothing.
+	void end_job(bool failed, const std::string &header)
+	{
+		if (failed)
+			pending.insert(0, header);
+		if (pending.empty())
+			return;
+		std::lock_guard<std::mutex> guard(lock);
+		out->sputn(pending.data(), pending.size());
+		out->pubsync();
+		pending.clear();
+	}
+};
+
+thread_local std::string JobErrors::pending;
+
+
+// Jobs waiting to run on one worker. The worker takes jobs from the front, and other workers
+// steal from the back once they run out.
+class JobQueue {
+private:
+	std::mutex lock;
+	std::deque<const batch_job*> jobs;
+
+public:
+	void push(const batch_job *job)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		jobs.push_back(job);
+	}
+
+	const batch_job *pop()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (jobs.empty())
+			return nullptr;
+		auto job = jobs.front();
+		jobs.pop_front();
+		return job;
+	}
+
+	const batch_job *steal()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (jobs.empty())
+			return nullptr;
+		auto job = jobs.back();
+		jobs.pop_back();
+		return job;
+	}
+};
+
+
+// Totals over every job, updated by the workers
+struct batch_totals {
+	std::atomic<uint64_t> failed{0};
+	std::atomic<uint64_t> instructions{0};
+};
+
+
+// Pins the calling thread to a core, where supported
+static void pin_to_core(size_t core)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core % CPU_SETSIZE, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)core;
+#endif
+}
+
+
+// Runs one job on the VM kept for its program
+// @ret - Whether the job ran and halted
+static bool run_job(const batch_job &job, const dtvm::Options &options,
+                    std::map<const Code*, std::unique_ptr<dtvm::VM>> &vms, batch_totals &totals)
+{
+	const auto &code = *job.code;
+	// Programs that failed to load were reported when reading the manifest
+	if (!code)
+		return false;
+	dtvm::FileInput input(job.input);
+	if (!input.is_open()) {
+		std::cerr << Error() << "Could not open file '" << job.input << "'" << std::endl;
+		return false;
+	}
+	dtvm::FileOutput output(job.output);
+	if (!output.is_open()) {
+		std::cerr << Error() << "Could not write file '" << job.output << "'" << std::endl;
+		return false;
+	}
+
+	auto &vm = vms[code.get()];
+	if (!vm)
+		vm.reset(new dtvm::VM(code, options));
+	uint64_t before = vm->instructions();
+	vm->reset(&input, &output);
+	bool halted = vm->run() == dtvm::status::halted;
+	// Nothing may be left pointing to this job's files
+	vm->reset(nullptr, nullptr);
+	totals.instructions += vm->instructions() - before;
+	return halted;
+}
+
+
+// Runs jobs from the worker's own queue, then from the others', until there are none left. The
+// worker keeps one VM per program and reuses it from job to job.
+// @arg id       - Index of the worker's queue
+// @arg queues   - Every worker's queue
+// @arg totals   - Where the outcome of the jobs is added up
+// @arg errors   - Where the messages of each job are held until it ends
+// @arg manifest - Path of the manifest, to name failed jobs by
+static void work(size_t id, std::vector<JobQueue> &queues, batch_totals &totals,
+                 JobErrors &errors, const std::string &manifest)
+{
+	if (dtvm_args::pin_threads)
+		pin_to_core(id);
+
+	dtvm::Options options;
+	options.num_regs = dtvm_args::num_regs;
+	options.tiering = dtvm_args::tiering;
+	options.stack_size = dtvm_args::stack_size;
+	options.flush = flush_policy::full;
+	options.count_instructions = dtvm_args::batch_stats;
+	std::map<const Code*, std::unique_ptr<dtvm::VM>> vms;
+
+	for (;;) {
+		const batch_job *job = queues[id].pop();
+		for (size_t i = 1; !job && i < queues.size(); i++)
+			job = queues[(id + i) % queues.size()].steal();
+		if (!job)
+			return;
+
+		bool failed = !run_job(*job, options, vms, totals);
+		if (failed)
+			totals.failed++;
+		std::ostringstream header;
+		header << Error() << "Job at " << manifest << '.' << job->line_num << " failed, running '" <<
+			job->program << "' on '" << job->input << "'\n";
+		errors.end_job(failed, header.str());
+	}
+}
+
+
+// Reads the manifest into jobs, loading every program it names once
+// @ret - Whether the manifest could be read
+static bool read_manifest(const std::string &program, const std::string &manifest,
+                          std::map<std::string, std::shared_ptr<const Code>> &programs,
+                          std::vector<batch_job> &jobs)
+{
+	std::ifstream file(manifest);
+	if (!file.is_open()) {
+		std::cerr << Error() << "Could not open file '" << manifest << "'" << std::endl;
+		return false;
+	}
+
+	std::string line;
+	for (int line_num = 1; std::getline(file, line); line_num++) {
+		std::istringstream fields(line);
+		std::string first, second, third;
+		if (!(fields >> first) || first[0] == ';')
+			continue;
+		fields >> second >> third;
+
+		batch_job job;
+		job.line_num = line_num;
+		std::string path = program;
+		if (program.empty()) {
+			if (second.empty()) {
+				std::cerr << Error() << "Missing input file at " << manifest << '.' << line_num <<
+					std::endl;
+				return false;
+			}
+			path = first;
+			job.input = second;
+			job.output = third;
+		} else {
+			job.input = first;
+			job.output = second;
+		}
+		if (job.output.empty())
+			job.output = job.input + ".out";
+
+		// Programs that fail to load stay in the map as null, and fail every job that runs them
+		auto found = programs.find(path);
+		if (found == programs.end())
+			found = programs.emplace(path, dtvm::load(path, dtvm_args::optimize)).first;
+		job.code = &found->second;
+		job.program = path;
+		jobs.push_back(std::move(job));
+	}
+	return true;
+}
+
+
+// run_batch
+// @exported
+// Runs many jobs in this process, spread over a pool of worker threads
+// @arg program  - Program run by every job, or empty if the manifest names them
+// @arg manifest - Path of the manifest
+// @ret - The exit code: 0 if every job ran and halted, 1 otherwise
+int run_batch(const std::string &program, const std::string &manifest)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	std::map<std::string, std::shared_ptr<const Code>> programs;
+	std::vector<batch_job> jobs;
+	if (!read_manifest(program, manifest, programs, jobs))
+		return 1;
+
+	size_t num_threads = dtvm_args::batch_threads;
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	num_threads = std::max<size_t>(1, std::min(num_threads, jobs.size()));
+
+	// Deal the jobs out in turns, so every worker starts with its share
+	std::vector<JobQueue> queues(num_threads);
+	for (size_t i = 0; i < jobs.size(); i++)
+		queues[i % num_threads].push(&jobs[i]);
+
+	batch_totals totals;
+	JobErrors errors(std::cerr.rdbuf());
+	std::cerr.rdbuf(&errors);
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < num_threads; i++)
+		workers.emplace_back(work, i, std::ref(queues), std::ref(totals), std::ref(errors),
+		                     std::cref(manifest));
+	work(0, queues, totals, errors, manifest);
+	for (auto &w : workers)
+		w.join();
+	std::cerr.rdbuf(errors.original());
+
+	if (dtvm_args::batch_stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		double seconds = elapsed.count();
+		std::cout << "jobs: " << jobs.size() << " (" << totals.failed << " failed) on " <<
+			num_threads << " threads in " << seconds << "s\n" <<
+			"jobs/s: " << jobs.size() / seconds << '\n' <<
+			"instructions/s: " << totals.instructions / seconds << std::endl;
+	}
+	return totals.failed == 0 ? 0 : 1;
+}
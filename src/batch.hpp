@@ -0,0 +1,21 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+// run_batch
+// @exported
+// Runs many jobs in this process, spread over a pool of worker threads. Each job reads its input
+// from a file and writes its output to another. The manifest has one job per line:
+// - `input [output]`, when `program` is given
+// - `program input [output]`, otherwise
+// The output file defaults to the input file followed by `.out`. Lines starting with ';' are
+// ignored. Each program is parsed once, however many jobs run it.
+// @arg program  - Program run by every job, or empty if the manifest names them
+// @arg manifest - Path of the manifest
+// @ret - The exit code: 0 if every job ran and halted, 1 otherwise
+int run_batch(const std::string &program, const std::string &manifest);
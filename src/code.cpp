@@ -3,43 +3,62 @@
 
 #include "code.hpp"
 
-#include "error.hpp"
+#include <algorithm>
+#include <limits>
+
 #include "args.hpp"
 
 
 // Empty constructor
 Code::Code()
-	: code(std::vector<var>()), data(std::vector<std::string>()), entry_point(-1)
+	: code(std::vector<instr>()), data(std::vector<std::string>()), consts(std::vector<var>()),
+	  entry_point(-1), max_stack(0), max_calls(0)
 {};
 
 
-// Append an instruction to the code
+// Append an instruction to the code. Its operands are filled through `back()`, `set_int` and
+// `set_float`.
 void Code::push_op(op o)
 {
-	code.push_back(var(o));
+	code.push_back(instr{o, 0, 0, 0});
+}
+
+
+// Set the integer literal of the last instruction, moving it to the constant pool when it
+// doesn't fit in the immediate field
+void Code::set_int(int64_t i)
+{
+	if (i >= std::numeric_limits<int32_t>::min() && i <= std::numeric_limits<int32_t>::max()) {
+		code.back().imm = static_cast<int32_t>(i);
+	} else {
+		code.back().code = op::cilw;
+		code.back().imm = static_cast<int32_t>(consts.size());
+		consts.push_back(var(i));
+	}
 }
 
 
-// Append an integer to the code
-void Code::push_int(int64_t i)
+// Set the floating point literal of the last instruction
+void Code::set_float(double f)
 {
-	code.push_back(var(i));
+	code.back().imm = static_cast<int32_t>(consts.size());
+	consts.push_back(var(f));
 }
 
 
-// Append a floating point value to the code
-void Code::push_float(double f)
+// Access the last instruction pushed
+instr& Code::back()
 {
-	code.push_back(var(f));
+	return code.back();
 }
 
 
 // Add a shortcut to access the data member
-var& Code::operator[](int idx)
+instr& Code::operator[](int idx)
 {
 	return code[idx];
 }
-var Code::operator[](int idx) const
+const instr& Code::operator[](int idx) const
 {
 	return code[idx];
 }
@@ -52,217 +71,367 @@ size_t Code::size() const
 }
 
 
-int display_line(std::ostream& o, const Code& c, int it)
+// Access the instruction stream as a contiguous array
+const instr *Code::raw() const
 {
-	switch (c[it].as_op()) {
-	case op::halt:
-		o << c[it].as_op();
-		it++;
-		break;
+	return code.data();
+}
 
-	case op::noop:
-		o << c[it].as_op();
-		it++;
-		break;
 
-	case op::mov:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
+// Replace the instruction stream by `count` instructions copied from `first`
+void Code::assign(const instr *first, size_t count)
+{
+	code.assign(first, first + count);
+}
 
-	case op::push:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
 
-	case op::pop:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
+// Remove the instructions marked in `removed`. Jump targets and the entry point are updated to
+// the new instruction indices, so the instructions removed must not affect the execution. A jump
+// to a removed instruction lands on the next instruction kept.
+void Code::remove(const std::vector<bool> &removed)
+{
+	// new_index[i] is the number of instructions kept before i
+	std::vector<int32_t> new_index(code.size() + 1);
+	size_t kept = 0;
+	for (size_t i = 0; i < code.size(); i++) {
+		new_index[i] = static_cast<int32_t>(kept);
+		if (!removed[i]) {
+			if (!lines.empty())
+				lines[kept] = lines[i];
+			code[kept++] = code[i];
+		}
+	}
+	new_index[code.size()] = static_cast<int32_t>(kept);
+	code.resize(kept);
+	if (!lines.empty())
+		lines.resize(kept);
+
+	for (auto &ins : code)
+		if (has_target(ins.code))
+			ins.imm = new_index[ins.imm];
+	entry_point = new_index[entry_point];
+	for (auto &l : labels)
+		l.index = new_index[l.index];
+}
+
+
+// Whether the `imm` of instructions with operation `o` is the index of an instruction
+bool has_target(op o)
+{
+	switch (o) {
+	case op::jmp:
+	case op::jgt:
+	case op::jeq:
+	case op::jlt:
+	case op::call:
+	case op::ucall:
+	case op::icmp_jgt:
+	case op::icmp_jeq:
+	case op::icmp_jlt:
+	case op::fcmp_jgt:
+	case op::fcmp_jeq:
+	case op::fcmp_jlt:
+	case op::icmpz_jgt:
+	case op::icmpz_jeq:
+	case op::icmpz_jlt:
+	case op::fcmpz_jgt:
+	case op::fcmpz_jeq:
+	case op::fcmpz_jlt:
+	case op::iinc_icmp_jgt:
+	case op::iinc_icmp_jeq:
+	case op::iinc_icmp_jlt:
+	case op::idec_icmp_jgt:
+	case op::idec_icmp_jeq:
+	case op::idec_icmp_jlt:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+// How many instructions an instruction with operation `o` stands for. Superinstructions stand
+// for the ones after them too, which are kept in place.
+size_t fused_length(op o)
+{
+	switch (o) {
+	case op::icmp_jgt:
+	case op::icmp_jeq:
+	case op::icmp_jlt:
+	case op::fcmp_jgt:
+	case op::fcmp_jeq:
+	case op::fcmp_jlt:
+	case op::icmpz_jgt:
+	case op::icmpz_jeq:
+	case op::icmpz_jlt:
+	case op::fcmpz_jgt:
+	case op::fcmpz_jeq:
+	case op::fcmpz_jlt:
+		return 2;
+	case op::iinc_icmp_jgt:
+	case op::iinc_icmp_jeq:
+	case op::iinc_icmp_jlt:
+	case op::idec_icmp_jgt:
+	case op::idec_icmp_jeq:
+	case op::idec_icmp_jlt:
+		return 3;
+	default:
+		return 1;
+	}
+}
+
+
+// One more than the highest register index referenced by the code
+size_t num_used_regs(const Code &code)
+{
+	size_t regs = 0;
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		const auto &ins = code[pc];
+		switch (ins.code) {
+		case op::halt:
+		case op::noop:
+		case op::onl:
+		case op::ret:
+		case op::uret:
+		case op::ods:
+		case op::jmp:
+		case op::jgt:
+		case op::jeq:
+		case op::jlt:
+		case op::call:
+		case op::ucall:
+			break;
+
+		case op::cil:
+		case op::cfl:
+		case op::cilw:
+			regs = std::max<size_t>(regs, ins.b + 1);
+			break;
+
+		default:
+			regs = std::max<size_t>(regs, std::max(ins.a, ins.b) + 1);
+			break;
+		}
+	}
+	return regs;
+}
 
-	case op::inc:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
 
+// The register instruction `ins` writes to, or -1 if it writes none. `pop`, `iiv` and `ifv`
+// count even though they leave it untouched when they fail.
+int written_reg(const instr &ins)
+{
+	switch (ins.code) {
+	case op::pop:
+	case op::upop:
+	case op::iiv:
+	case op::ifv:
+	case op::ipf:
+	case op::inc:
+	case op::inc_i:
+	case op::inc_f:
+	case op::iinc:
+	case op::finc:
 	case op::dec:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
+	case op::dec_i:
+	case op::dec_f:
+	case op::idec:
+	case op::fdec:
+	case op::iinc_icmp_jgt:
+	case op::iinc_icmp_jeq:
+	case op::iinc_icmp_jlt:
+	case op::idec_icmp_jgt:
+	case op::idec_icmp_jeq:
+	case op::idec_icmp_jlt:
+		return ins.a;
 
+	case op::mov:
+	case op::cil:
+	case op::cfl:
+	case op::cilw:
 	case op::add:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
-
+	case op::add_ii:
+	case op::add_ff:
+	case op::iadd:
+	case op::fadd:
 	case op::sub:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
-
+	case op::sub_ii:
+	case op::sub_ff:
+	case op::isub:
+	case op::fsub:
 	case op::mul:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
-
+	case op::mul_ii:
+	case op::mul_ff:
+	case op::imul:
+	case op::fmul:
 	case op::div:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
-
+	case op::div_ii:
+	case op::div_ff:
+	case op::idiv:
+	case op::fdiv:
 	case op::mod:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
+	case op::mod_ii:
+	case op::imod:
+		return ins.b;
 
-	case op::cil:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
+	default:
+		return -1;
+	}
+}
 
-	case op::cfl:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_float() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
 
-	case op::ods:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
+// label_before
+// @exported
+// @arg code - The code, with its labels
+// @arg pc   - Index of an instruction
+// @ret - Index in `code.labels` of the last label at or before instruction `pc`, or -1
+int label_before(const Code &code, size_t pc)
+{
+	auto after = std::upper_bound(code.labels.begin(), code.labels.end(), pc,
+		[](size_t pc, const code_label &l) { return pc < static_cast<size_t>(l.index); });
+	return static_cast<int>(after - code.labels.begin()) - 1;
+}
 
-	case op::ofv:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
 
+// label_called
+// @exported
+// The label a call to instruction `pc` is named after: the first label at `pc`, since the ones
+// after it at the same instruction are usually its sublabels
+// @arg code - The code, with its labels
+// @arg pc   - Index of the instruction called
+// @ret - Index in `code.labels`, or `label_before(code, pc)` if no label is at `pc`
+int label_called(const Code &code, size_t pc)
+{
+	auto first = std::lower_bound(code.labels.begin(), code.labels.end(), pc,
+		[](const code_label &l, size_t pc) { return static_cast<size_t>(l.index) < pc; });
+	if (first != code.labels.end() && static_cast<size_t>(first->index) == pc)
+		return static_cast<int>(first - code.labels.begin());
+	return label_before(code, pc);
+}
+
+
+// Prints a single instruction, which doesn't need to be part of `c`. Constants are taken from `c`.
+void display_instr(std::ostream& o, const instr &ins, const Code& c)
+{
+	switch (ins.code) {
+	// No operands
+	case op::halt:
+	case op::noop:
 	case op::onl:
-		o << c[it].as_op();
-		it++;
+	case op::ret:
+	case op::uret:
+		o << ins.code;
 		break;
 
+	// One register
+	case op::push:
+	case op::upush:
+	case op::pop:
+	case op::upop:
+	case op::inc:
+	case op::inc_i:
+	case op::inc_f:
+	case op::iinc:
+	case op::finc:
+	case op::iinc_icmp_jgt:
+	case op::iinc_icmp_jeq:
+	case op::iinc_icmp_jlt:
+	case op::dec:
+	case op::dec_i:
+	case op::dec_f:
+	case op::idec:
+	case op::fdec:
+	case op::idec_icmp_jgt:
+	case op::idec_icmp_jeq:
+	case op::idec_icmp_jlt:
+	case op::ofv:
 	case op::iiv:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
-
 	case op::ifv:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
-
 	case op::ipf:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
+	case op::cmpz:
+	case op::cmpz_i:
+	case op::cmpz_f:
+	case op::icmpz:
+	case op::fcmpz:
+	case op::icmpz_jgt:
+	case op::icmpz_jeq:
+	case op::icmpz_jlt:
+	case op::fcmpz_jgt:
+	case op::fcmpz_jeq:
+	case op::fcmpz_jlt:
+		o << ins.code << '\t' << ins.a;
 		break;
 
+	// Two registers
+	case op::mov:
+	case op::add:
+	case op::add_ii:
+	case op::add_ff:
+	case op::iadd:
+	case op::fadd:
+	case op::sub:
+	case op::sub_ii:
+	case op::sub_ff:
+	case op::isub:
+	case op::fsub:
+	case op::mul:
+	case op::mul_ii:
+	case op::mul_ff:
+	case op::imul:
+	case op::fmul:
+	case op::div:
+	case op::div_ii:
+	case op::div_ff:
+	case op::idiv:
+	case op::fdiv:
+	case op::mod:
+	case op::mod_ii:
+	case op::imod:
 	case op::cmp:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
+	case op::cmp_ii:
+	case op::cmp_ff:
+	case op::icmp:
+	case op::fcmp:
+	case op::icmp_jgt:
+	case op::icmp_jeq:
+	case op::icmp_jlt:
+	case op::fcmp_jgt:
+	case op::fcmp_jeq:
+	case op::fcmp_jlt:
+		o << ins.code << '\t' << ins.a << '\t' << ins.b;
 		break;
 
-	case op::cmpz:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
+	// Literal and register
+	case op::cil:
+		o << ins.code << '\t' << ins.imm << '\t' << ins.b;
 		break;
 
-	case op::jmp:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
+	case op::cfl:
+		o << ins.code << '\t' << c.consts[ins.imm].as_float() << '\t' << ins.b;
 		break;
 
-	case op::jgt:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
+	case op::cilw:
+		o << ins.code << '\t' << c.consts[ins.imm].as_int() << '\t' << ins.b;
 		break;
 
+	// Data index or instruction index
+	case op::ods:
+	case op::jmp:
+	case op::jgt:
 	case op::jeq:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
-
 	case op::jlt:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
-
 	case op::call:
-		o << c[it].as_op() << '\t';
-		it++;
-		o << c[it].as_int();
-		it++;
-		break;
-
-	case op::ret:
-		o << c[it].as_op();
-		it++;
+	case op::ucall:
+		o << ins.code << '\t' << ins.imm;
 		break;
 	}
+}
 
-	return it;
+
+int display_line(std::ostream& o, const Code& c, int it)
+{
+	display_instr(o, c[it], c);
+	return it + 1;
 }
 
 
@@ -287,10 +456,6 @@ std::ostream &operator<<(std::ostream &o, const Code &c)
 
 		o << '\n' << it << ":\t";
 
-		if (c[it].get_type() != var_type::operation) {
-			std::cerr << Error() << "Tried to display a non-op as op at " << it << std::endl;
-		}
-
 		it = display_line(o, c, it);
 	}
 }
@@ -5,6 +5,7 @@
 
 #include <cinttypes>
 #include <ostream>
+#include <string>
 #include <vector>
 #include <iostream>
 
@@ -12,26 +13,84 @@
 #include "var.hpp"
 
 
+// Register indices are packed into 16 bits in each instruction
+constexpr int max_num_regs = 65536;
+
+
+// A single decoded instruction.
+// Which fields are meaningful depends on the operation:
+// - `a` and `b` hold the first and second register operands, in source order. Instructions with
+//   a literal and a register (`cil`, `cfl`) keep the register in `b`.
+// - `imm` holds the integer literal of `cil`, the constant pool index of `cfl` and `cilw`, the
+//   data index of `ods` or the instruction index jumped to by j** and `call`.
+struct instr {
+	op code;
+	uint16_t a;
+	uint16_t b;
+	int32_t imm;
+};
+static_assert(sizeof(instr) == 12, "instr should be packed into 12 bytes");
+
+
+// A label and the index of the instruction it refers to
+struct code_label {
+	std::string name;
+	int index;
+};
+
+
 class Code {
 private:
-	std::vector<var> code;
+	std::vector<instr> code;
 
 public:
 	std::vector<std::string> data;
+	// Literals that don't fit in `instr::imm`
+	std::vector<var> consts;
 
 	Code();
 
 	void push_op(op o);
-	void push_int(int64_t i);
-	void push_float(double f);
+	void set_int(int64_t i);
+	void set_float(double f);
 
-	var& operator[](int idx);
-	var operator[](int idx) const;
+	instr& back();
+	instr& operator[](int idx);
+	const instr& operator[](int idx) const;
 
 	size_t size() const;
 
+	// The whole instruction stream at once, for the precompiled format
+	const instr *raw() const;
+	void assign(const instr *first, size_t count);
+
+	void remove(const std::vector<bool> &removed);
+
 	int entry_point;
+	// Deepest the stack and the callstack get, as proven by `analyze_depth`. The unchecked
+	// instructions it emits rely on the VM having room for that many entries.
+	size_t max_stack;
+	size_t max_calls;
+	// Every label, sublabels expanded, in the order they appear in the source, and the source
+	// line of each instruction (0 for the `halt` added at the end). Only kept for code parsed from
+	// source, for profiles.
+	std::vector<code_label> labels;
+	std::vector<int> lines;
 };
 
+// Whether the `imm` of instructions with operation `o` is the index of an instruction
+bool has_target(op o);
+// How many instructions an instruction with operation `o` stands for, counting itself
+size_t fused_length(op o);
+// One more than the highest register index referenced by the code
+size_t num_used_regs(const Code &code);
+// The register instruction `ins` writes to, or -1 if it writes none
+int written_reg(const instr &ins);
+// Index in `code.labels` of the last label at or before instruction `pc`, or -1
+int label_before(const Code &code, size_t pc);
+// Index in `code.labels` of the label a call to instruction `pc` is named after, or -1
+int label_called(const Code &code, size_t pc);
+
+void display_instr(std::ostream& o, const instr &ins, const Code& c);
 int display_line(std::ostream& o, const Code& c, int it);
 std::ostream &operator<<(std::ostream &o, const Code &c);
@@ -0,0 +1,394 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "depth.hpp"
+
+#include <algorithm>
+#include <vector>
+
+
+// Depths are kept between -unbounded and unbounded, which stand for any depth at all
+static const int64_t unbounded = int64_t(1) << 40;
+// Deeper stacks are left checked, so the VM never has to preallocate more than this
+static const int64_t max_static_depth = int64_t(1) << 24;
+// Above this many (function, instruction) pairs the analysis is skipped to bound its memory use
+static const size_t max_state_cells = size_t(1) << 22;
+// Rounds after which anything still growing is taken to grow forever
+static const int widen_after = 2;
+
+
+// Adds two depths, moving towards `unbounded` if either of them is unbounded
+static int64_t add_up(int64_t a, int64_t b)
+{
+	if (a == unbounded || b == unbounded)
+		return unbounded;
+	if (a == -unbounded || b == -unbounded)
+		return -unbounded;
+	return std::max(-unbounded, std::min(unbounded, a + b));
+}
+
+// Adds two depths, moving towards `-unbounded` if either of them is unbounded
+static int64_t add_down(int64_t a, int64_t b)
+{
+	if (a == -unbounded || b == -unbounded)
+		return -unbounded;
+	if (a == unbounded || b == unbounded)
+		return unbounded;
+	return std::max(-unbounded, std::min(unbounded, a + b));
+}
+
+
+// The checked variant of a stack instruction, or `o` itself
+static op checked(op o)
+{
+	switch (o) {
+	case op::upush:
+		return op::push;
+	case op::upop:
+		return op::pop;
+	case op::ucall:
+		return op::call;
+	case op::uret:
+		return op::ret;
+	default:
+		return o;
+	}
+}
+
+
+// Depths some point can be reached at. Empty while the point is not known to be reached.
+struct depth_range {
+	int64_t lo = unbounded;
+	int64_t hi = -unbounded;
+
+	bool empty() const
+	{
+		return lo > hi;
+	}
+
+	bool operator==(const depth_range &r) const
+	{
+		return lo == r.lo && hi == r.hi;
+	}
+
+	depth_range operator+(const depth_range &r) const
+	{
+		if (empty() || r.empty())
+			return depth_range();
+		return {add_down(lo, r.lo), add_up(hi, r.hi)};
+	}
+
+	// Smallest range holding both
+	depth_range join(const depth_range &r) const
+	{
+		return {std::min(lo, r.lo), std::max(hi, r.hi)};
+	}
+
+	// `join`, with every bound that moves taken as unbounded
+	depth_range widen(const depth_range &r) const
+	{
+		if (empty())
+			return r;
+		depth_range j = join(r);
+		return {j.lo < lo ? -unbounded : lo, j.hi > hi ? unbounded : hi};
+	}
+};
+
+
+// The entry point, or an instruction that is called
+struct function {
+	size_t entry;
+	// Stack depths it returns at, relative to the entry. Empty if it never returns.
+	depth_range returns;
+	// Stack depth before each instruction, relative to the entry
+	std::vector<depth_range> at;
+	// Depths of the stack and of the callstack at the entry, over every call
+	depth_range stack;
+	depth_range calls;
+};
+
+
+// Analysis state shared by the helpers below
+struct depth_analysis {
+	const Code &code;
+	std::vector<function> functions;
+	// Index in `functions` of each instruction that starts one, or -1
+	std::vector<int> function_at;
+	std::vector<size_t> worklist;
+
+	explicit depth_analysis(const Code &c)
+		: code(c), function_at(c.size(), -1)
+	{}
+
+	const function &callee(const instr &ins) const
+	{
+		return functions[function_at[ins.imm]];
+	}
+};
+
+
+// callees
+// Functions called by the function starting at `entry`, on any path, in the order they are found
+// @arg da    - The analysis state
+// @arg entry - Index of the first instruction of the function
+static std::vector<size_t> callees(depth_analysis &da, size_t entry)
+{
+	const auto &code = da.code;
+	std::vector<bool> seen(code.size(), false);
+	std::vector<size_t> found;
+	std::vector<size_t> work{entry};
+	seen[entry] = true;
+
+	auto visit = [&](size_t pc) {
+		if (pc < code.size() && !seen[pc]) {
+			seen[pc] = true;
+			work.push_back(pc);
+		}
+	};
+
+	while (!work.empty()) {
+		size_t pc = work.back();
+		work.pop_back();
+		const auto &ins = code[pc];
+		switch (ins.code) {
+		case op::halt:
+		case op::ret:
+		case op::uret:
+			break;
+		case op::call:
+		case op::ucall:
+			found.push_back(da.function_at[ins.imm]);
+			visit(pc + 1);
+			break;
+		case op::jmp:
+			visit(ins.imm);
+			break;
+		default:
+			if (has_target(ins.code))
+				visit(ins.imm);
+			visit(pc + 1);
+			break;
+		}
+	}
+	return found;
+}
+
+
+// flow
+// Merges `d` into the depths before instruction `pc` of `f`, queueing it if they changed. Depths
+// growing along a backward jump are widened, since every loop has one.
+static void flow(depth_analysis &da, function &f, size_t pc, const depth_range &d, bool backward)
+{
+	// Running past the last instruction ends the program
+	if (pc >= f.at.size() || d.empty())
+		return;
+	auto merged = backward ? f.at[pc].widen(d) : f.at[pc].join(d);
+	if (merged == f.at[pc])
+		return;
+	f.at[pc] = merged;
+	da.worklist.push_back(pc);
+}
+
+
+// analyze
+// Computes the depth before every instruction of `f` relative to its entry, from the current
+// summaries of its callees
+// @arg da - The analysis state
+// @arg f  - The function to analyze
+// @ret - The stack depths `f` returns at
+static depth_range analyze(depth_analysis &da, function &f)
+{
+	const auto &code = da.code;
+	depth_range returns;
+	f.at.assign(code.size(), depth_range());
+	flow(da, f, f.entry, {0, 0}, false);
+
+	while (!da.worklist.empty()) {
+		size_t pc = da.worklist.back();
+		da.worklist.pop_back();
+		const auto &ins = code[pc];
+		const auto d = f.at[pc];
+
+		switch (ins.code) {
+		case op::halt:
+			break;
+
+		case op::push:
+		case op::upush:
+			flow(da, f, pc + 1, d + depth_range{1, 1}, false);
+			break;
+
+		case op::pop:
+		case op::upop:
+			flow(da, f, pc + 1, d + depth_range{-1, -1}, false);
+			break;
+
+		case op::call:
+		case op::ucall:
+			flow(da, f, pc + 1, d + da.callee(ins).returns, false);
+			break;
+
+		case op::ret:
+		case op::uret:
+			returns = returns.join(d);
+			break;
+
+		case op::jmp:
+			flow(da, f, ins.imm, d, static_cast<size_t>(ins.imm) <= pc);
+			break;
+
+		default:
+			if (has_target(ins.code))
+				flow(da, f, ins.imm, d, static_cast<size_t>(ins.imm) <= pc);
+			flow(da, f, pc + 1, d, false);
+			break;
+		}
+	}
+	return returns;
+}
+
+
+// propagate
+// Adds the depths `f` calls each of its callees at to the callee's entry depths
+// @ret - Whether any callee's entry depths changed
+static bool propagate(depth_analysis &da, const function &f, bool widen)
+{
+	bool changed = false;
+	for (size_t pc = 0; pc < f.at.size(); pc++) {
+		const auto &ins = da.code[pc];
+		if (f.at[pc].empty() || (ins.code != op::call && ins.code != op::ucall))
+			continue;
+		auto &g = da.functions[da.function_at[ins.imm]];
+		auto stack = f.stack + f.at[pc];
+		// The stack is never shallower than empty
+		stack.lo = std::max<int64_t>(stack.lo, 0);
+		auto calls = f.calls + depth_range{1, 1};
+		auto new_stack = widen ? g.stack.widen(stack) : g.stack.join(stack);
+		auto new_calls = widen ? g.calls.widen(calls) : g.calls.join(calls);
+		if (new_stack == g.stack && new_calls == g.calls)
+			continue;
+		g.stack = new_stack;
+		g.calls = new_calls;
+		changed = true;
+	}
+	return changed;
+}
+
+
+// analyze_depth
+// @exported
+// Bounds the depth of the stack and of the callstack at every reachable instruction, and rewrites
+// the stack instructions that can never overflow or underflow into their unchecked variants
+// @arg code - The code to rewrite in place, after `infer_types`
+void analyze_depth(Code &code)
+{
+	// Nothing is taken from a previous run
+	for (size_t pc = 0; pc < code.size(); pc++)
+		code[pc].code = checked(code[pc].code);
+	code.max_stack = code.max_calls = 0;
+
+	depth_analysis da(code);
+	auto add_function = [&](size_t entry) {
+		if (da.function_at[entry] < 0) {
+			da.function_at[entry] = static_cast<int>(da.functions.size());
+			da.functions.push_back(function{entry, {}, {}, {}, {}});
+		}
+	};
+	add_function(code.entry_point);
+	for (size_t pc = 0; pc < code.size(); pc++)
+		if (code[pc].code == op::call || code[pc].code == op::ucall)
+			add_function(code[pc].imm);
+	if (da.functions.size() * code.size() > max_state_cells)
+		return;
+
+	// What each function returns at depends on what its callees return at. Callees come before
+	// their callers, so that only recursion takes more than one round to settle.
+	std::vector<std::vector<size_t>> calls;
+	for (auto &f : da.functions)
+		calls.push_back(callees(da, f.entry));
+	std::vector<size_t> order;
+	std::vector<bool> visited(da.functions.size(), false);
+	std::vector<std::pair<size_t, size_t>> path{{0, 0}};
+	visited[0] = true;
+	while (!path.empty()) {
+		auto &top = path.back();
+		if (top.second == calls[top.first].size()) {
+			order.push_back(top.first);
+			path.pop_back();
+			continue;
+		}
+		size_t next = calls[top.first][top.second++];
+		if (!visited[next]) {
+			visited[next] = true;
+			path.emplace_back(next, 0);
+		}
+	}
+
+	bool changed = true;
+	for (int round = 1; changed; round++) {
+		changed = false;
+		for (auto i : order) {
+			auto &f = da.functions[i];
+			auto returns = round > widen_after ? f.returns.widen(analyze(da, f)) :
+				f.returns.join(analyze(da, f));
+			if (returns == f.returns)
+				continue;
+			f.returns = returns;
+			changed = true;
+		}
+	}
+
+	// Entry depths flow from callers to callees, so go the other way around
+	da.functions[0].stack = {0, 0};
+	da.functions[0].calls = {0, 0};
+	changed = true;
+	for (int round = 1; changed; round++) {
+		changed = false;
+		for (auto i = order.rbegin(); i != order.rend(); i++)
+			changed |= propagate(da, da.functions[*i], round > widen_after);
+	}
+
+	// Absolute depths before each instruction, over every function it is part of
+	std::vector<depth_range> stack(code.size()), callstack(code.size());
+	for (auto i : order) {
+		const auto &f = da.functions[i];
+		for (size_t pc = 0; pc < code.size(); pc++) {
+			auto d = f.stack + f.at[pc];
+			if (d.empty())
+				continue;
+			d.lo = std::max<int64_t>(d.lo, 0);
+			stack[pc] = stack[pc].join(d);
+			callstack[pc] = callstack[pc].join(f.calls);
+		}
+	}
+
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		auto &ins = code[pc];
+		if (stack[pc].empty())
+			continue;
+		switch (ins.code) {
+		case op::push:
+			if (stack[pc].hi < max_static_depth) {
+				ins.code = op::upush;
+				code.max_stack = std::max<size_t>(code.max_stack, stack[pc].hi + 1);
+			}
+			break;
+		case op::pop:
+			if (stack[pc].lo >= 1)
+				ins.code = op::upop;
+			break;
+		case op::call:
+			if (callstack[pc].hi < max_static_depth) {
+				ins.code = op::ucall;
+				code.max_calls = std::max<size_t>(code.max_calls, callstack[pc].hi + 1);
+			}
+			break;
+		case op::ret:
+			if (callstack[pc].lo >= 1)
+				ins.code = op::uret;
+			break;
+		default:
+			break;
+		}
+	}
+}
@@ -0,0 +1,19 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include "code.hpp"
+
+
+// analyze_depth
+// @exported
+// Bounds the depth of the stack and of the callstack at every reachable instruction, and rewrites
+// the stack instructions that can never overflow or underflow into their unchecked variants.
+// Depths are tracked relative to the entry of each function, so a function that pushes and pops
+// a fixed number of values is bounded wherever it is called from. Loops that push or pop, and
+// recursion, leave the instructions that depend on them checked. The deepest proven depths are
+// stored in `code.max_stack` and `code.max_calls`. Unchecked instructions already in the code are
+// proven again.
+// @arg code - The code to rewrite in place, after `infer_types`
+void analyze_depth(Code &code);
@@ -0,0 +1,216 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "dtb.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "depth.hpp"
+#include "error.hpp"
+#include "file.hpp"
+
+
+// Precompiled format
+// Everything is stored in host byte order, right after the header:
+// - `num_instrs` raw `instr` records
+// - zero padding up to a multiple of 8 bytes
+// - `num_consts` constants, each a 32-bit type, 32 bits of padding and the 64-bit value
+// - `num_data` strings, each a 64-bit length followed by the characters
+// Files are only loaded by builds with the same version, byte order and `instr` layout.
+// The version must be bumped whenever `op` or `instr` change.
+constexpr char dtb_magic[4] = {'D', 'T', 'B', '\0'};
+constexpr uint32_t dtb_version = 2;
+constexpr uint32_t dtb_byte_order = 0x01020304;
+
+struct dtb_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t instr_size;
+	int64_t entry_point;
+	uint64_t num_instrs;
+	uint64_t num_consts;
+	uint64_t num_data;
+};
+static_assert(sizeof(dtb_header) % alignof(instr) == 0, "instructions must stay aligned");
+
+
+// Appends the bytes of `v` to `out`
+template <typename T>
+static void put(std::vector<char> &out, const T &v)
+{
+	const char *bytes = reinterpret_cast<const char*>(&v);
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+
+// write_dtb
+// @exported
+// Writes already parsed code to a file in the precompiled format
+// @arg code - The code to write
+// @arg path - Path of the file to write
+// @ret - Whether the file was written. Errors are reported on stderr.
+bool write_dtb(const Code &code, const std::string &path)
+{
+	dtb_header header;
+	std::memcpy(header.magic, dtb_magic, sizeof(dtb_magic));
+	header.version = dtb_version;
+	header.byte_order = dtb_byte_order;
+	header.instr_size = sizeof(instr);
+	header.entry_point = code.entry_point;
+	header.num_instrs = code.size();
+	header.num_consts = code.consts.size();
+	header.num_data = code.data.size();
+
+	std::vector<char> out;
+	put(out, header);
+	const char *instrs = reinterpret_cast<const char*>(code.raw());
+	out.insert(out.end(), instrs, instrs + code.size() * sizeof(instr));
+	out.resize((out.size() + 7) / 8 * 8, '\0');
+	for (auto &c : code.consts) {
+		uint32_t type = static_cast<uint32_t>(c.get_type());
+		uint32_t padding = 0;
+		put(out, type);
+		put(out, padding);
+		if (c.get_type() == var_type::integer)
+			put(out, c.as_int());
+		else
+			put(out, c.as_float());
+	}
+	for (auto &d : code.data) {
+		uint64_t length = d.size();
+		put(out, length);
+		out.insert(out.end(), d.begin(), d.end());
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open() || !file.write(out.data(), out.size())) {
+		std::cerr << Error() << "Could not write file '" << path << "'" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+// is_dtb
+// @exported
+// @arg path - Path of the file to check
+// @ret - Whether the file starts like a precompiled file
+bool is_dtb(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	char magic[sizeof(dtb_magic)];
+	return file.read(magic, sizeof(magic)) && std::memcmp(magic, dtb_magic, sizeof(magic)) == 0;
+}
+
+
+// Reads a `T` at `at`, moving `at` past it. Returns false if the file is too short.
+template <typename T>
+static bool get(const FileView &file, size_t &at, T &v)
+{
+	if (file.size - at < sizeof(T))
+		return false;
+	std::memcpy(&v, file.data + at, sizeof(T));
+	at += sizeof(T);
+	return true;
+}
+
+
+// Checks that every operand of the loaded code refers to something that exists, so that a
+// corrupt file can't make the VM read out of bounds
+static bool validate(const Code &code)
+{
+	if (code.entry_point < 0 || static_cast<size_t>(code.entry_point) >= code.size())
+		return false;
+	for (size_t i = 0; i < code.size(); i++) {
+		const instr &in = code[i];
+		if (static_cast<size_t>(in.code) >= num_ops)
+			return false;
+		if (has_target(in.code) && (in.imm < 0 || static_cast<size_t>(in.imm) >= code.size()))
+			return false;
+		if ((in.code == op::cfl || in.code == op::cilw) &&
+			(in.imm < 0 || static_cast<size_t>(in.imm) >= code.consts.size()))
+			return false;
+		if (in.code == op::ods && (in.imm < 0 || static_cast<size_t>(in.imm) >= code.data.size()))
+			return false;
+	}
+	return true;
+}
+
+
+// load_dtb
+// @exported
+// Loads code written by `write_dtb`, without parsing anything. The file is mapped in memory and
+// the instruction records are taken from it as they are.
+// @arg path - Path of the file to load
+// @ret - The Code object. An empty Code object is returned on error.
+Code load_dtb(const std::string &path)
+{
+	FileView file(path);
+	if (!file.is_open()) {
+		std::cerr << Error() << "Could not open file '" << path << "'" << std::endl;
+		return Code();
+	}
+
+	size_t at = 0;
+	dtb_header header;
+	if (!get(file, at, header) || std::memcmp(header.magic, dtb_magic, sizeof(dtb_magic)) != 0) {
+		std::cerr << Error() << "'" << path << "' is not a precompiled file" << std::endl;
+		return Code();
+	}
+	if (header.version != dtb_version || header.byte_order != dtb_byte_order ||
+		header.instr_size != sizeof(instr)) {
+		std::cerr << Error() << "'" << path << "' was precompiled by an incompatible version" <<
+			std::endl;
+		return Code();
+	}
+
+	Code code;
+	bool ok = (file.size - at) / sizeof(instr) >= header.num_instrs;
+	if (ok) {
+		// The records are copied as they are, in one go. The interpreter rewrites instructions
+		// while running, so it needs its own copy anyway. The header keeps them aligned.
+		code.assign(reinterpret_cast<const instr*>(file.data + at), header.num_instrs);
+		at = (at + header.num_instrs * sizeof(instr) + 7) / 8 * 8;
+	}
+	for (uint64_t i = 0; ok && i < header.num_consts; i++) {
+		uint32_t type, padding;
+		int64_t value;
+		ok = get(file, at, type) && get(file, at, padding) && get(file, at, value);
+		if (!ok)
+			break;
+		if (type == static_cast<uint32_t>(var_type::integer)) {
+			code.consts.push_back(var(value));
+		} else if (type == static_cast<uint32_t>(var_type::floating)) {
+			double f;
+			std::memcpy(&f, &value, sizeof(f));
+			code.consts.push_back(var(f));
+		} else {
+			ok = false;
+		}
+	}
+	for (uint64_t i = 0; ok && i < header.num_data; i++) {
+		uint64_t length;
+		ok = get(file, at, length) && file.size - at >= length;
+		if (ok) {
+			code.data.emplace_back(file.data + at, length);
+			at += length;
+		}
+	}
+	// Checked before narrowing it, so that no corrupt value wraps around into range
+	if (header.entry_point < 0 || static_cast<uint64_t>(header.entry_point) >= header.num_instrs)
+		ok = false;
+	else
+		code.entry_point = static_cast<int>(header.entry_point);
+
+	if (!ok || !validate(code)) {
+		std::cerr << Error() << "'" << path << "' is corrupt" << std::endl;
+		return Code();
+	}
+	// A tampered file could make unchecked stack instructions overflow, so they are proven again
+	analyze_depth(code);
+	return code;
+}
@@ -0,0 +1,30 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <string>
+
+#include "code.hpp"
+
+
+// write_dtb
+// @exported
+// Writes already parsed code to a file in the precompiled format
+// @arg code - The code to write
+// @arg path - Path of the file to write
+// @ret - Whether the file was written. Errors are reported on stderr.
+bool write_dtb(const Code &code, const std::string &path);
+
+// is_dtb
+// @exported
+// @arg path - Path of the file to check
+// @ret - Whether the file starts like a precompiled file
+bool is_dtb(const std::string &path);
+
+// load_dtb
+// @exported
+// Loads code written by `write_dtb`, without parsing anything
+// @arg path - Path of the file to load
+// @ret - The Code object. An empty Code object is returned on error.
+Code load_dtb(const std::string &path);
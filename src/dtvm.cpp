@@ -0,0 +1,144 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "dtvm.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "depth.hpp"
+#include "dtb.hpp"
+#include "error.hpp"
+#include "fuse.hpp"
+#include "infer.hpp"
+#include "optimize.hpp"
+#include "parser.hpp"
+
+
+namespace dtvm {
+
+// read
+// @exported
+// Reads a source or precompiled file, and resolves it as far as the precompiled format stores it.
+// Sources are parsed, optimized if asked to, and typed.
+// @arg path     - Path of the file
+// @arg optimize - Whether to optimize a source file
+// @ret - The Code object. An empty Code object is returned on error, which is reported on stderr.
+Code read(const std::string &path, bool optimize)
+{
+	// Precompiled code went through every pass below already
+	if (is_dtb(path))
+		return load_dtb(path);
+
+	// Attempt to open file
+	FileView file(path);
+	if (!file.is_open()) {
+		std::cerr << Error() << "Could not open file '" << path << "'" << std::endl;
+		return Code();
+	}
+
+	// Parse code
+	Code code = parse(file.view(), path);
+	if (code.size() == 0) {
+		std::cerr << Error() << "Got invalid code from parser" << std::endl;
+		return Code();
+	}
+
+	if (optimize)
+		::optimize(code);
+
+	// Replace type checks by statically typed instructions wherever possible, and stack depth
+	// checks by unchecked instructions
+	infer_types(code);
+	analyze_depth(code);
+	return code;
+}
+
+
+// load
+// @exported
+// Reads a file into code ready to be run by any number of VMs
+// @arg path     - Path of the file
+// @arg optimize - Whether to optimize a source file
+// @ret - The code, or null on error, which is reported on stderr
+std::shared_ptr<const Code> load(const std::string &path, bool optimize)
+{
+	Code code = read(path, optimize);
+	if (code.size() == 0)
+		return nullptr;
+	fuse(code);
+	return std::make_shared<const Code>(std::move(code));
+}
+
+
+// Map or read the whole file at `path`
+FileInput::FileInput(const std::string &path)
+	: file(path)
+{
+}
+
+bool FileInput::is_open() const
+{
+	return file.is_open();
+}
+
+std::string_view FileInput::contents()
+{
+	return file.view();
+}
+
+// The contents are always in memory, so nothing is left to read
+size_t FileInput::read(char *, size_t)
+{
+	return 0;
+}
+
+
+StringInput::StringInput(std::string_view text)
+	: text(text)
+{
+}
+
+std::string_view StringInput::contents()
+{
+	return text;
+}
+
+// The contents are always in memory, so nothing is left to read
+size_t StringInput::read(char *, size_t)
+{
+	return 0;
+}
+
+
+// Create or truncate the file at `path`. `is_open` tells whether it could be.
+FileOutput::FileOutput(const std::string &path)
+	: file(std::fopen(path.c_str(), "wb"))
+{
+}
+
+FileOutput::~FileOutput()
+{
+	if (file)
+		std::fclose(file);
+}
+
+bool FileOutput::is_open() const
+{
+	return file != nullptr;
+}
+
+void FileOutput::write(const char *data, size_t size)
+{
+	if (file)
+		std::fwrite(data, 1, size, file);
+}
+
+
+void StringOutput::write(const char *data, size_t size)
+{
+	text.append(data, size);
+}
+
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+// Public interface of libdtvm
+// A program is loaded once into an immutable `Code`, which any number of `dtvm::VM`s can then run,
+// each on its own thread if needed. Loading still reads the `dtvm_args` settings (entry point and
+// number of registers), so they must not change while a program is being loaded.
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "args.hpp"
+#include "code.hpp"
+#include "file.hpp"
+#include "input.hpp"
+#include "output.hpp"
+#include "vm.hpp"
+
+
+namespace dtvm {
+
+// read
+// @exported
+// Reads a source or precompiled file, and resolves it as far as the precompiled format stores it
+// @arg path     - Path of the file
+// @arg optimize - Whether to optimize a source file
+// @ret - The Code object. An empty Code object is returned on error, which is reported on stderr.
+Code read(const std::string &path, bool optimize);
+
+// load
+// @exported
+// Reads a file into code ready to be run by any number of VMs
+// @arg path     - Path of the file
+// @arg optimize - Whether to optimize a source file
+// @ret - The code, or null on error, which is reported on stderr
+std::shared_ptr<const Code> load(const std::string &path, bool optimize = false);
+
+
+// Input read from a file, which is mapped in memory where possible
+class FileInput : public InputSource {
+private:
+	FileView file;
+
+public:
+	explicit FileInput(const std::string &path);
+
+	bool is_open() const;
+	std::string_view contents() override;
+	size_t read(char *buffer, size_t size) override;
+};
+
+// Input held in memory. The text must outlive the source.
+class StringInput : public InputSource {
+private:
+	std::string_view text;
+
+public:
+	explicit StringInput(std::string_view text);
+
+	std::string_view contents() override;
+	size_t read(char *buffer, size_t size) override;
+};
+
+// Output written to a file, which is created or truncated
+class FileOutput : public OutputSink {
+private:
+	std::FILE *file;
+
+public:
+	explicit FileOutput(const std::string &path);
+	~FileOutput();
+
+	FileOutput(const FileOutput&) = delete;
+	FileOutput &operator=(const FileOutput&) = delete;
+
+	bool is_open() const;
+	void write(const char *data, size_t size) override;
+};
+
+// Output collected in memory
+class StringOutput : public OutputSink {
+public:
+	std::string text;
+
+	void write(const char *data, size_t size) override;
+};
+
+}
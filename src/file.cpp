@@ -0,0 +1,72 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "file.hpp"
+
+#include <fstream>
+#include <iterator>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// Map or read the file at `path`. `is_open` tells whether it could be opened.
+FileView::FileView(const std::string &path)
+	: mapped(nullptr), mapped_size(0), opened(false), data(nullptr), size(0)
+{
+#ifdef __unix__
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat st;
+	// Empty files can't be mapped, and neither can pipes and the like
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mem != MAP_FAILED) {
+			mapped = static_cast<const char*>(mem);
+			mapped_size = st.st_size;
+		}
+	}
+	close(fd);
+	if (mapped) {
+		opened = true;
+		data = mapped;
+		size = mapped_size;
+		return;
+	}
+#endif
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+		return;
+	contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	opened = true;
+	data = contents.data();
+	size = contents.size();
+}
+
+
+FileView::~FileView()
+{
+#ifdef __unix__
+	if (mapped)
+		munmap(const_cast<char*>(mapped), mapped_size);
+#endif
+}
+
+
+// Whether the file could be opened
+bool FileView::is_open() const
+{
+	return opened;
+}
+
+
+// The contents of the file
+std::string_view FileView::view() const
+{
+	return std::string_view(data, size);
+}
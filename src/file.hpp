@@ -0,0 +1,32 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// A read-only view of a whole file. The file is mapped in memory where possible, and read into
+// a buffer otherwise.
+class FileView {
+private:
+	std::vector<char> contents;
+	const char *mapped;
+	size_t mapped_size;
+	bool opened;
+
+public:
+	const char *data;
+	size_t size;
+
+	explicit FileView(const std::string &path);
+	~FileView();
+
+	FileView(const FileView&) = delete;
+	FileView &operator=(const FileView&) = delete;
+
+	bool is_open() const;
+	std::string_view view() const;
+};
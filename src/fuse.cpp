@@ -0,0 +1,82 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "fuse.hpp"
+
+
+// jump_index
+// Position of a conditional jump within each group of three fused variants.
+// @ret - 0 for `jgt`, 1 for `jeq`, 2 for `jlt`, and -1 for anything else.
+static int jump_index(op o)
+{
+	switch (o) {
+	case op::jgt:
+		return 0;
+	case op::jeq:
+		return 1;
+	case op::jlt:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+
+// variant
+// Picks the fused variant for a conditional jump out of the `jgt`, `jeq`, `jlt` group starting at
+// `first`.
+static op variant(op first, op jump)
+{
+	return static_cast<op>(static_cast<int>(first) + jump_index(jump));
+}
+
+
+// fuse
+// @exported
+// Rewrites statically typed compare-and-branch and counter loop sequences into
+// superinstructions. Must run after `infer_types`, since only statically typed instructions are
+// fused. Only the first instruction of a sequence is rewritten, so instruction indices and jumps
+// into the middle of a sequence are unaffected.
+// @arg code - The code to rewrite in place
+void fuse(Code &code)
+{
+	// The code always ends with a halt, which is never fused, so looking ahead of a fusable
+	// instruction never goes out of bounds. Instructions are visited in order, so the ones ahead
+	// haven't been rewritten yet.
+	for (size_t pc = 0; pc + 1 < code.size(); pc++) {
+		auto &ins = code[pc];
+		const auto &next = code[pc + 1];
+
+		switch (ins.code) {
+		case op::icmp:
+		case op::fcmp:
+		case op::icmpz:
+		case op::fcmpz:
+			if (jump_index(next.code) < 0)
+				break;
+			ins.imm = next.imm;
+			ins.code = variant(
+				ins.code == op::icmp ? op::icmp_jgt :
+				ins.code == op::fcmp ? op::fcmp_jgt :
+				ins.code == op::icmpz ? op::icmpz_jgt : op::fcmpz_jgt,
+				next.code);
+			break;
+
+		case op::iinc:
+		case op::idec:
+			// The counter must be the first operand of the comparison
+			if (next.code != op::icmp || next.a != ins.a || pc + 2 >= code.size())
+				break;
+			if (jump_index(code[pc + 2].code) < 0)
+				break;
+			ins.b = next.b;
+			ins.imm = code[pc + 2].imm;
+			ins.code = variant(ins.code == op::iinc ? op::iinc_icmp_jgt : op::idec_icmp_jgt,
+			                   code[pc + 2].code);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
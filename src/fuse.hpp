@@ -0,0 +1,16 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include "code.hpp"
+
+
+// fuse
+// @exported
+// Rewrites statically typed compare-and-branch and counter loop sequences into
+// superinstructions. Must run after `infer_types`, since only statically typed instructions are
+// fused. Only the first instruction of a sequence is rewritten, so instruction indices and jumps
+// into the middle of a sequence are unaffected.
+// @arg code - The code to rewrite in place
+void fuse(Code &code);
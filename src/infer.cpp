@@ -0,0 +1,272 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "infer.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "error.hpp"
+
+
+// The type of a register at some point of the program is the set of types it may hold there.
+// An empty set means the point was not reached by the analysis yet.
+enum type_set : uint8_t {
+	TYPE_NONE  = 0b00,
+	TYPE_INT   = 0b01,
+	TYPE_FLOAT = 0b10,
+	TYPE_ANY   = 0b11,
+};
+
+// Above this many (instruction, register) pairs the analysis is skipped to bound its memory use
+static const size_t max_state_cells = size_t(1) << 26;
+
+
+// binary_type
+// Type shared by both operands of a two-register arithmetic or comparison instruction, given that
+// the instruction only proceeds when the types are equal.
+static uint8_t binary_type(const uint8_t *in, const instr &ins)
+{
+	return in[ins.a] & in[ins.b];
+}
+
+
+// typed_variant
+// Picks the statically typed variant of an instruction, if the types of its operands allow it.
+// @arg in  - Register types before the instruction
+// @arg ins - The instruction
+// @ret - The statically typed operation, or the instruction's own operation otherwise
+static op typed_variant(const uint8_t *in, const instr &ins)
+{
+	const auto one = in[ins.a];
+	const bool two_int = in[ins.a] == TYPE_INT && in[ins.b] == TYPE_INT;
+	const bool two_float = in[ins.a] == TYPE_FLOAT && in[ins.b] == TYPE_FLOAT;
+
+	switch (ins.code) {
+	case op::inc:
+		return one == TYPE_INT ? op::iinc : one == TYPE_FLOAT ? op::finc : ins.code;
+	case op::dec:
+		return one == TYPE_INT ? op::idec : one == TYPE_FLOAT ? op::fdec : ins.code;
+	case op::cmpz:
+		return one == TYPE_INT ? op::icmpz : one == TYPE_FLOAT ? op::fcmpz : ins.code;
+	case op::add:
+		return two_int ? op::iadd : two_float ? op::fadd : ins.code;
+	case op::sub:
+		return two_int ? op::isub : two_float ? op::fsub : ins.code;
+	case op::mul:
+		return two_int ? op::imul : two_float ? op::fmul : ins.code;
+	case op::div:
+		return two_int ? op::idiv : two_float ? op::fdiv : ins.code;
+	case op::mod:
+		return two_int ? op::imod : ins.code;
+	case op::cmp:
+		return two_int ? op::icmp : two_float ? op::fcmp : ins.code;
+	default:
+		return ins.code;
+	}
+}
+
+
+// Analysis state shared by the helpers below
+struct inference {
+	const Code &code;
+	size_t regs;
+	// Register types before each instruction, `regs` entries per instruction. Every register of
+	// a reached instruction has at least one type, so unreached ones are all TYPE_NONE.
+	std::vector<uint8_t> state;
+	// Union of the types of every value pushed to the stack anywhere in the program
+	uint8_t stack_type;
+	// Index of the instruction following each `call`, where every `ret` may return to
+	std::vector<size_t> return_sites;
+	std::vector<size_t> worklist;
+
+	inference(const Code &c, size_t r)
+		: code(c), regs(r), state(c.size() * r, TYPE_NONE), stack_type(TYPE_NONE)
+	{}
+
+	uint8_t *at(size_t pc) { return &state[pc * regs]; }
+
+	// Merges `out` into the state before instruction `pc`, queueing it if anything changed
+	void flow(const uint8_t *out, size_t pc)
+	{
+		auto in = at(pc);
+		bool changed = false;
+		for (size_t r = 0; r < regs; r++) {
+			if ((in[r] | out[r]) != in[r]) {
+				in[r] |= out[r];
+				changed = true;
+			}
+		}
+		if (changed)
+			worklist.push_back(pc);
+	}
+};
+
+
+// step
+// Applies the effect of instruction `pc` to its state and propagates the result to every
+// instruction that may run right after it.
+// @arg inf - The analysis state
+// @arg pc  - Index of the instruction
+// @arg out - Scratch buffer of `inf.regs` entries
+static void step(inference &inf, size_t pc, std::vector<uint8_t> &out)
+{
+	const auto &ins = inf.code[pc];
+	const auto in = inf.at(pc);
+	std::copy(in, in + inf.regs, out.begin());
+
+	switch (ins.code) {
+	case op::halt:
+		return;
+
+	case op::mov:
+		out[ins.b] = in[ins.a];
+		break;
+
+	case op::push:
+		if ((inf.stack_type | in[ins.a]) != inf.stack_type) {
+			inf.stack_type |= in[ins.a];
+			// Every `pop` may now produce a new type
+			for (size_t i = 0; i < inf.code.size(); i++)
+				if (inf.code[i].code == op::pop && inf.at(i)[0] != TYPE_NONE)
+					inf.worklist.push_back(i);
+		}
+		break;
+
+	case op::pop:
+		out[ins.a] = inf.stack_type == TYPE_NONE ? uint8_t(TYPE_ANY) : inf.stack_type;
+		break;
+
+	case op::add:
+	case op::sub:
+	case op::mul:
+	case op::div:
+	case op::cmp:
+		// Execution only continues past the instruction when both operands share a type
+		out[ins.a] = out[ins.b] = binary_type(in, ins);
+		if (out[ins.a] == TYPE_NONE)
+			return;
+		break;
+
+	case op::mod:
+		out[ins.a] = out[ins.b] = binary_type(in, ins) & TYPE_INT;
+		if (out[ins.a] == TYPE_NONE)
+			return;
+		break;
+
+	case op::cil:
+	case op::cilw:
+		out[ins.b] = TYPE_INT;
+		break;
+
+	case op::cfl:
+		out[ins.b] = TYPE_FLOAT;
+		break;
+
+	case op::iiv:
+		// The register is left untouched when reading fails
+		out[ins.a] |= TYPE_INT;
+		break;
+
+	case op::ifv:
+		out[ins.a] |= TYPE_FLOAT;
+		break;
+
+	case op::ipf:
+		out[ins.a] = TYPE_INT;
+		break;
+
+	case op::jmp:
+		inf.flow(out.data(), ins.imm);
+		return;
+
+	case op::jgt:
+	case op::jeq:
+	case op::jlt:
+		inf.flow(out.data(), ins.imm);
+		break;
+
+	case op::call:
+		inf.flow(out.data(), ins.imm);
+		return;
+
+	case op::ret:
+		for (auto site : inf.return_sites)
+			inf.flow(out.data(), site);
+		return;
+
+	default:
+		break;
+	}
+
+	inf.flow(out.data(), pc + 1);
+}
+
+
+// report
+// Warns about instructions that fail with a type error whenever they run.
+// @arg in  - Register types before the instruction
+// @arg ins - The instruction
+// @arg pc  - Index of the instruction
+static void report(const uint8_t *in, const instr &ins, size_t pc)
+{
+	switch (ins.code) {
+	case op::add:
+	case op::sub:
+	case op::mul:
+	case op::div:
+	case op::cmp:
+		if (binary_type(in, ins) == TYPE_NONE)
+			std::cerr << Warn() << "Type mismatch at " << pc << " if it is reached" << std::endl;
+		break;
+
+	case op::mod:
+		if (binary_type(in, ins) == TYPE_NONE)
+			std::cerr << Warn() << "Type mismatch at " << pc << " if it is reached" << std::endl;
+		else if ((binary_type(in, ins) & TYPE_INT) == TYPE_NONE)
+			std::cerr << Warn() << "Invalid type at " << pc << " if it is reached" << std::endl;
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+// infer_types
+// @exported
+// Infers the type of every register at every reachable instruction and rewrites arithmetic and
+// comparison instructions whose operand types are known on every path into their statically
+// typed variants. Instructions that fail with a type error whenever they run are reported as
+// warnings and left untouched, so the error still happens at runtime if they are ever reached.
+// @arg code - The parsed code, rewritten in place
+void infer_types(Code &code)
+{
+	const auto regs = num_used_regs(code);
+	if (regs == 0 || code.size() * regs > max_state_cells)
+		return;
+
+	inference inf(code, regs);
+	for (size_t pc = 0; pc < code.size(); pc++)
+		if (code[pc].code == op::call)
+			inf.return_sites.push_back(pc + 1);
+
+	// Every register starts as the integer 0
+	std::vector<uint8_t> out(regs, TYPE_INT);
+	inf.flow(out.data(), code.entry_point);
+	while (!inf.worklist.empty()) {
+		const auto pc = inf.worklist.back();
+		inf.worklist.pop_back();
+		step(inf, pc, out);
+	}
+
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		const auto in = inf.at(pc);
+		// Unreachable instruction
+		if (in[0] == TYPE_NONE)
+			continue;
+		report(in, code[pc], pc);
+		code[pc].code = typed_variant(in, code[pc]);
+	}
+}
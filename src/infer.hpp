@@ -0,0 +1,16 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include "code.hpp"
+
+
+// infer_types
+// @exported
+// Infers the type of every register at every reachable instruction and rewrites arithmetic and
+// comparison instructions whose operand types are known on every path into their statically
+// typed variants. Instructions that fail with a type error whenever they run are reported as
+// warnings and left untouched, so the error still happens at runtime if they are ever reached.
+// @arg code - The parsed code, rewritten in place
+void infer_types(Code &code);
@@ -0,0 +1,187 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "input.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifdef __unix__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "number.hpp"
+
+
+// Size of each read from stdin when it can't be mapped
+constexpr size_t input_block_size = 1 << 16;
+
+
+// Read from `source`, or from stdin if it's null
+Input::Input(InputSource *source)
+	: source(nullptr), mapped(nullptr), mapped_size(0), data(nullptr), begin(0), end(0),
+	  at_eof(false)
+{
+	reset(source);
+}
+
+
+Input::~Input()
+{
+#ifdef __unix__
+	if (mapped)
+		munmap(const_cast<char*>(mapped), mapped_size);
+#endif
+}
+
+
+// Input::reset
+// Starts reading from `source`, or from stdin if it's null, dropping whatever was left from
+// before. Stdin is mapped if it is a regular file, starting from wherever its offset is.
+void Input::reset(InputSource *source)
+{
+#ifdef __unix__
+	if (mapped)
+		munmap(const_cast<char*>(mapped), mapped_size);
+#endif
+	this->source = source;
+	mapped = nullptr;
+	mapped_size = 0;
+	data = nullptr;
+	begin = end = 0;
+	at_eof = false;
+
+	if (source) {
+		auto contents = source->contents();
+		if (!contents.empty()) {
+			data = contents.data();
+			end = contents.size();
+			at_eof = true;
+		}
+		return;
+	}
+#ifdef __unix__
+	struct stat st;
+	off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+	if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && offset >= 0) {
+		void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+		if (mem != MAP_FAILED) {
+			mapped = static_cast<const char*>(mem);
+			mapped_size = st.st_size;
+			data = mapped;
+			begin = std::min<size_t>(offset, mapped_size);
+			end = mapped_size;
+			at_eof = true;
+		}
+	}
+#endif
+}
+
+
+// Reads another block from stdin after the unread characters, which are moved to the front
+// @ret - Whether anything was read
+bool Input::fill()
+{
+	if (at_eof)
+		return false;
+	if (begin > 0) {
+		std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+		end -= begin;
+		begin = 0;
+	}
+	if (buffer.size() - end < input_block_size)
+		buffer.resize(end + input_block_size);
+	data = buffer.data();
+
+	if (source) {
+		size_t got = source->read(buffer.data() + end, buffer.size() - end);
+		if (got == 0) {
+			at_eof = true;
+			return false;
+		}
+		end += got;
+		return true;
+	}
+#ifdef __unix__
+	ssize_t got;
+	do {
+		got = read(STDIN_FILENO, buffer.data() + end, buffer.size() - end);
+	} while (got < 0 && errno == EINTR);
+#else
+	std::cin.read(buffer.data() + end, buffer.size() - end);
+	std::streamsize got = std::cin.gcount();
+#endif
+	if (got <= 0) {
+		at_eof = true;
+		return false;
+	}
+	end += got;
+	return true;
+}
+
+
+// Skips whitespace, line breaks included
+// @ret - Whether there is anything left to read
+bool Input::skip_space()
+{
+	do {
+		while (begin < end && is_space(data[begin]))
+			begin++;
+		if (begin < end)
+			return true;
+	} while (fill());
+	return false;
+}
+
+
+// Consumes the rest of the current line, line break included
+// @ret - The rest of the line, without the line break. It stays valid until the next read.
+std::string_view Input::line()
+{
+	size_t scanned = begin;
+	for (;;) {
+		auto found = static_cast<const char*>(std::memchr(data + scanned, '\n', end - scanned));
+		if (found) {
+			size_t line_end = found - data;
+			std::string_view rest(data + begin, line_end - begin);
+			begin = line_end + 1;
+			return rest;
+		}
+		// `fill` moves the unread characters to the front
+		scanned = end - begin;
+		if (!fill())
+			break;
+	}
+	std::string_view rest(data + begin, end - begin);
+	begin = end;
+	return rest;
+}
+
+
+// Reads an integer from the next line that isn't blank. The rest of that line is skipped.
+// @arg v - Receives the integer. Left untouched on failure.
+// @ret - Whether an integer was read
+bool Input::integer(int64_t &v)
+{
+	if (!skip_space())
+		return false;
+	size_t pos = 0;
+	return read_integer(line(), pos, v);
+}
+
+
+// Reads a floating point number from the next line that isn't blank. The rest of that line is
+// skipped.
+// @arg v - Receives the number. Not meaningful on failure.
+// @ret - Whether a number was read
+bool Input::floating(double &v)
+{
+	if (!skip_space())
+		return false;
+	size_t pos = 0;
+	return read_floating(line(), pos, v);
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <cinttypes>
+#include <string_view>
+#include <vector>
+
+
+// Provides the input of a program, for programs that don't read stdin
+class InputSource {
+public:
+	virtual ~InputSource() = default;
+
+	// All of the input at once, if it is already in memory. Empty if it has to be read.
+	virtual std::string_view contents()
+	{
+		return std::string_view();
+	}
+
+	// Reads up to `size` characters into `buffer`
+	// @ret - Number of characters read, 0 once there is nothing left
+	virtual size_t read(char *buffer, size_t size) = 0;
+};
+
+
+// Buffered input of a running program, from an `InputSource` or stdin. Stdin is mapped in memory when it is a regular
+// file, and read in large blocks otherwise. Every read behaves like `std::cin >> v` followed by
+// skipping the rest of the line, failed or not.
+class Input {
+private:
+	InputSource *source;
+	std::vector<char> buffer;
+	const char *mapped;
+	size_t mapped_size;
+	// Unread characters are `data[begin, end)`
+	const char *data;
+	size_t begin;
+	size_t end;
+	bool at_eof;
+
+	bool fill();
+	bool skip_space();
+	std::string_view line();
+
+public:
+	explicit Input(InputSource *source);
+	~Input();
+
+	Input(const Input&) = delete;
+	Input &operator=(const Input&) = delete;
+
+	void reset(InputSource *source);
+	bool integer(int64_t &v);
+	bool floating(double &v);
+};
@@ -0,0 +1,845 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "jit.hpp"
+
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <utility>
+
+#include "error.hpp"
+
+// The templates assume registers are an array of values in the 16-byte layout
+#if defined(__x86_64__) && defined(__unix__) && !defined(DTVM_NAN_BOXING) && \
+	!defined(DTVM_SPLIT_REGISTERS)
+#define DTVM_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef DTVM_JIT
+
+// Generated code keeps the same state in the same host registers for its whole run:
+// - RBX points to the VM registers, which are addressed as [RBX + index * sizeof(var)]
+// - R12 points to the `jit_runtime`, passed as the first argument of every helper
+// - R13 points to the native address of each instruction, for `ret`
+// - R14 holds the VM flags
+// RAX, RDX, RSI, RDI, XMM0 and XMM1 are scratch. The stack is kept 16-byte aligned once the
+// prologue has run, so helpers can be called from anywhere without saving anything.
+enum x64_reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum x64_xmm { XMM0, XMM1 };
+
+// Condition codes, as encoded in the opcode of `jcc`
+enum x64_cond { CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8, CC_P = 0xA, CC_L = 0xC };
+
+static_assert(sizeof(var_type) == 4, "the type of a var is compared as a dword");
+static_assert(sizeof(var) % 8 == 0, "vars are copied as qwords");
+
+static const uint32_t int_tag = static_cast<uint32_t>(var_type::integer);
+static const uint32_t float_tag = static_cast<uint32_t>(var_type::floating);
+
+
+// What helpers called from generated code need to get to
+struct jit_runtime {
+	vm_state &state;
+	const Code &code;
+};
+
+// Returned in RAX:RDX by generated code
+struct jit_exit {
+	int64_t pc;
+	uint64_t flags;
+};
+
+using jit_entry = jit_exit (*)(jit_runtime *rt, var *reg, const uint8_t *const *targets,
+	uint64_t flags, const uint8_t *start);
+using jit_helper = void (*)(jit_runtime *rt, uint64_t arg);
+
+
+// Runtime helpers
+// Instructions that touch the stacks or do I/O call back into these, with the operand of the
+// instruction (or its index, for errors) as `arg`. Helpers that can fail return -1 once the error
+// is reported.
+
+// Stops the program on an error about instruction `pc`
+static int64_t jit_fail(jit_runtime *rt, const char *what, uint64_t pc)
+{
+	rt->state.failed = true;
+	rt->state.out.flush();
+	std::cerr << Error() << what << " at " << pc << std::endl;
+	return -1;
+}
+
+static int64_t jit_push(jit_runtime *rt, uint64_t arg)
+{
+	if (rt->state.stack.full())
+		return jit_fail(rt, "Stack overflow", arg);
+	rt->state.stack.push(rt->state.reg[rt->code[arg].a]);
+	return 0;
+}
+
+static void jit_upush(jit_runtime *rt, uint64_t arg)
+{
+	rt->state.stack.push(rt->state.reg[arg]);
+}
+
+static int64_t jit_pop(jit_runtime *rt, uint64_t arg)
+{
+	if (rt->state.stack.empty())
+		return jit_fail(rt, "`pop` in an empty stack", arg);
+	rt->state.reg[rt->code[arg].a] = rt->state.stack.pop();
+	return 0;
+}
+
+static void jit_upop(jit_runtime *rt, uint64_t arg)
+{
+	rt->state.reg[arg] = rt->state.stack.pop();
+}
+
+static void jit_ods(jit_runtime *rt, uint64_t arg)
+{
+	rt->state.out.write(rt->code.data[arg]);
+}
+
+static void jit_ofv(jit_runtime *rt, uint64_t arg)
+{
+	rt->state.out.write(rt->state.reg[arg]);
+	rt->state.out.put(' ');
+}
+
+static void jit_onl(jit_runtime *rt, uint64_t)
+{
+	rt->state.out.newline();
+}
+
+static void jit_iiv(jit_runtime *rt, uint64_t arg)
+{
+	int64_t token;
+	rt->state.out.before_input();
+	if (rt->state.in.integer(token)) {
+		rt->state.stdin_state = 0;
+		rt->state.reg[arg] = token;
+	} else {
+		rt->state.stdin_state = 1;
+	}
+}
+
+static void jit_ifv(jit_runtime *rt, uint64_t arg)
+{
+	double token;
+	rt->state.out.before_input();
+	if (rt->state.in.floating(token)) {
+		rt->state.stdin_state = 0;
+		rt->state.reg[arg] = token;
+	} else {
+		rt->state.stdin_state = 1;
+	}
+}
+
+static void jit_ipf(jit_runtime *rt, uint64_t arg)
+{
+	rt->state.reg[arg] = int64_t(rt->state.stdin_state);
+}
+
+// Pushes the instruction after `call` instruction `arg`
+static int64_t jit_call(jit_runtime *rt, uint64_t arg)
+{
+	if (rt->state.callstack.full())
+		return jit_fail(rt, "Callstack overflow", arg);
+	rt->state.callstack.push(arg + 1);
+	return 0;
+}
+
+static void jit_ucall(jit_runtime *rt, uint64_t arg)
+{
+	rt->state.callstack.push(arg + 1);
+}
+
+// Returns the index of the instruction to return to
+static int64_t jit_ret(jit_runtime *rt, uint64_t arg)
+{
+	if (rt->state.callstack.empty())
+		return jit_fail(rt, "`ret` in an empty callstack", arg);
+	return rt->state.callstack.pop();
+}
+
+static int64_t jit_uret(jit_runtime *rt, uint64_t)
+{
+	return rt->state.callstack.pop();
+}
+
+static void jit_type_mismatch(jit_runtime *rt, uint64_t arg)
+{
+	rt->state.failed = true;
+	rt->state.out.flush();
+	std::cerr << Error() << "Type mismatch at " << arg << std::endl;
+}
+
+static void jit_invalid_type(jit_runtime *rt, uint64_t arg)
+{
+	rt->state.failed = true;
+	rt->state.out.flush();
+	std::cerr << Error() << "Invalid type at " << arg << std::endl;
+}
+
+
+// Assembler
+// Encodes the few x86-64 instructions the templates need. Memory operands are always
+// [base + disp32].
+class Assembler {
+public:
+	std::vector<uint8_t> bytes;
+
+	size_t size() const
+	{
+		return bytes.size();
+	}
+
+	void emit(std::initializer_list<uint8_t> b)
+	{
+		bytes.insert(bytes.end(), b);
+	}
+
+	void emit32(uint32_t v)
+	{
+		for (int i = 0; i < 4; i++)
+			bytes.push_back(uint8_t(v >> (8 * i)));
+	}
+
+	void emit64(uint64_t v)
+	{
+		for (int i = 0; i < 8; i++)
+			bytes.push_back(uint8_t(v >> (8 * i)));
+	}
+
+	// Mandatory prefixes, REX (when needed) and opcode
+	void opcode(std::initializer_list<uint8_t> prefix, bool w, int reg, int rm,
+		std::initializer_list<uint8_t> opc)
+	{
+		emit(prefix);
+		uint8_t rex = 0x40 | (w ? 0x08 : 0) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+		if (rex != 0x40)
+			bytes.push_back(rex);
+		emit(opc);
+	}
+
+	// Instruction with a register (or opcode extension) `reg` and a memory operand
+	void mem(std::initializer_list<uint8_t> prefix, bool w, std::initializer_list<uint8_t> opc,
+		int reg, int base, int32_t disp)
+	{
+		opcode(prefix, w, reg, base, opc);
+		bytes.push_back(0x80 | (reg & 7) << 3 | (base & 7));
+		if ((base & 7) == RSP)
+			bytes.push_back(0x24);
+		emit32(disp);
+	}
+
+	// Instruction with two register operands
+	void direct(std::initializer_list<uint8_t> prefix, bool w, std::initializer_list<uint8_t> opc,
+		int reg, int rm)
+	{
+		opcode(prefix, w, reg, rm, opc);
+		bytes.push_back(0xC0 | (reg & 7) << 3 | (rm & 7));
+	}
+
+	void mov_imm(int reg, uint64_t v)
+	{
+		opcode({}, true, 0, reg, {});
+		bytes.push_back(0xB8 + (reg & 7));
+		emit64(v);
+	}
+
+	// Jumps return the position of their rel32, to be bound later
+	size_t jcc(x64_cond cond)
+	{
+		emit({0x0F});
+		bytes.push_back(0x80 + cond);
+		emit32(0);
+		return size() - 4;
+	}
+
+	size_t jmp()
+	{
+		emit({0xE9});
+		emit32(0);
+		return size() - 4;
+	}
+
+	void bind(size_t at, size_t target)
+	{
+		uint32_t rel = static_cast<uint32_t>(target - (at + 4));
+		for (int i = 0; i < 4; i++)
+			bytes[at + i] = uint8_t(rel >> (8 * i));
+	}
+};
+
+
+static int32_t type_of(uint16_t r)
+{
+	return static_cast<int32_t>(r * sizeof(var) + var::type_offset);
+}
+
+static int32_t value_of(uint16_t r)
+{
+	return static_cast<int32_t>(r * sizeof(var) + var::value_offset);
+}
+
+
+enum class arith { add, sub, mul, div, mod };
+
+
+// Compiler
+// Translates each instruction with a fixed template, in order. Jumps to other instructions, to
+// error reports and to the epilogue are bound once everything has been emitted.
+class Compiler {
+private:
+	const Code &code;
+	// The instructions translated, which may have been rewritten since `code` was parsed
+	const instr *ins;
+	Assembler a;
+	// Offset of the native code of each instruction
+	std::vector<size_t> native;
+	// Jumps to instructions, as (rel32 position, instruction index)
+	std::vector<std::pair<size_t, size_t>> branches;
+	// Jumps to the epilogue, with the value to return in RAX
+	std::vector<size_t> exits;
+	// Jumps to error reports
+	struct error_stub {
+		size_t at;
+		size_t pc;
+		jit_helper report;
+	};
+	std::vector<error_stub> errors;
+
+	template <typename F>
+	void call(F fn, uint64_t arg)
+	{
+		a.direct({}, true, {0x89}, R12, RDI);
+		a.mov_imm(RSI, arg);
+		a.mov_imm(RAX, reinterpret_cast<uint64_t>(fn));
+		a.emit({0xFF, 0xD0});
+	}
+
+	void jump_to(size_t target)
+	{
+		branches.emplace_back(a.jmp(), target);
+	}
+
+	void branch(uint8_t mask, size_t target)
+	{
+		// test r14b, mask; jnz target
+		a.emit({0x41, 0xF6, 0xC6, mask});
+		branches.emplace_back(a.jcc(CC_NE), target);
+	}
+
+	void leave()
+	{
+		exits.push_back(a.jmp());
+	}
+
+	// Leaves with RAX as it is if a helper returned -1
+	void leave_on_error()
+	{
+		// test rax, rax; js exit
+		a.direct({}, true, {0x85}, RAX, RAX);
+		exits.push_back(a.jcc(CC_S));
+	}
+
+	void error(x64_cond cond, size_t pc, jit_helper report)
+	{
+		errors.push_back({a.jcc(cond), pc, report});
+	}
+
+	// Leaves the type of `a` in EAX, and reports an error unless `b` has the same type
+	void check_same_type(size_t pc, const instr &in)
+	{
+		a.mem({}, false, {0x8B}, RAX, RBX, type_of(in.a));
+		a.mem({}, false, {0x3B}, RAX, RBX, type_of(in.b));
+		error(CC_NE, pc, jit_type_mismatch);
+	}
+
+	// Jumps if EAX doesn't hold the type of integers
+	size_t unless_int()
+	{
+		a.emit({0x83, 0xF8});
+		a.emit({uint8_t(int_tag)});
+		return a.jcc(CC_NE);
+	}
+
+	void set_int(uint16_t r, int64_t v)
+	{
+		a.mem({}, false, {0xC7}, 0, RBX, type_of(r));
+		a.emit32(int_tag);
+		a.mov_imm(RAX, v);
+		a.mem({}, true, {0x89}, RAX, RBX, value_of(r));
+	}
+
+	void set_float(uint16_t r, double v)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		a.mem({}, false, {0xC7}, 0, RBX, type_of(r));
+		a.emit32(float_tag);
+		a.mov_imm(RAX, bits);
+		a.mem({}, true, {0x89}, RAX, RBX, value_of(r));
+	}
+
+	void int_step(const instr &in, bool down)
+	{
+		// add/sub qword [a], 1
+		a.mem({}, true, {0x83}, down ? 5 : 0, RBX, value_of(in.a));
+		a.emit({1});
+	}
+
+	void float_step(const instr &in, bool down)
+	{
+		a.mem({0xF2}, false, {0x0F, 0x10}, XMM0, RBX, value_of(in.a));
+		set_float_one();
+		a.direct({0xF2}, false, {0x0F, uint8_t(down ? 0x5C : 0x58)}, XMM0, XMM1);
+		a.mem({0xF2}, false, {0x0F, 0x11}, XMM0, RBX, value_of(in.a));
+	}
+
+	void set_float_one()
+	{
+		double one = 1;
+		uint64_t bits;
+		std::memcpy(&bits, &one, sizeof(bits));
+		a.mov_imm(RAX, bits);
+		a.direct({0x66}, true, {0x0F, 0x6E}, XMM1, RAX);
+	}
+
+	void int_arith(const instr &in, arith kind)
+	{
+		a.mem({}, true, {0x8B}, RAX, RBX, value_of(in.b));
+		switch (kind) {
+		case arith::add:
+			a.mem({}, true, {0x03}, RAX, RBX, value_of(in.a));
+			break;
+		case arith::sub:
+			a.mem({}, true, {0x2B}, RAX, RBX, value_of(in.a));
+			break;
+		case arith::mul:
+			a.mem({}, true, {0x0F, 0xAF}, RAX, RBX, value_of(in.a));
+			break;
+		case arith::div:
+		case arith::mod:
+			// cqo; idiv qword [a]
+			a.emit({0x48, 0x99});
+			a.mem({}, true, {0xF7}, 7, RBX, value_of(in.a));
+			break;
+		}
+		a.mem({}, true, {0x89}, kind == arith::mod ? RDX : RAX, RBX, value_of(in.b));
+	}
+
+	void float_arith(const instr &in, arith kind)
+	{
+		uint8_t opc = 0;
+		switch (kind) {
+		case arith::add: opc = 0x58; break;
+		case arith::sub: opc = 0x5C; break;
+		case arith::mul: opc = 0x59; break;
+		case arith::div: opc = 0x5E; break;
+		case arith::mod: return;
+		}
+		a.mem({0xF2}, false, {0x0F, 0x10}, XMM0, RBX, value_of(in.b));
+		a.mem({0xF2}, false, {0x0F, opc}, XMM0, RBX, value_of(in.a));
+		a.mem({0xF2}, false, {0x0F, 0x11}, XMM0, RBX, value_of(in.b));
+	}
+
+	// Sets R14 from the host flags left by `cmp` (signed) or `ucomisd`, the same way `compare`
+	// does in the interpreter: unordered floats compare as greater.
+	void set_flags(bool floating)
+	{
+		std::vector<size_t> done;
+		if (floating) {
+			a.emit({0x41, 0xBE});
+			a.emit32(VM_FLAG_GT);
+			done.push_back(a.jcc(CC_P));
+		}
+		a.emit({0x41, 0xBE});
+		a.emit32(VM_FLAG_LT);
+		done.push_back(a.jcc(floating ? CC_B : CC_L));
+		a.emit({0x41, 0xBE});
+		a.emit32(VM_FLAG_EQ);
+		done.push_back(a.jcc(CC_E));
+		a.emit({0x41, 0xBE});
+		a.emit32(VM_FLAG_GT);
+		for (auto at : done)
+			a.bind(at, a.size());
+	}
+
+	void int_compare(const instr &in, bool zero)
+	{
+		if (zero) {
+			a.mem({}, true, {0x83}, 7, RBX, value_of(in.a));
+			a.emit({0});
+		} else {
+			a.mem({}, true, {0x8B}, RAX, RBX, value_of(in.a));
+			a.mem({}, true, {0x3B}, RAX, RBX, value_of(in.b));
+		}
+		set_flags(false);
+	}
+
+	void float_compare(const instr &in, bool zero)
+	{
+		a.mem({0xF2}, false, {0x0F, 0x10}, XMM0, RBX, value_of(in.a));
+		if (zero) {
+			a.direct({0x66}, false, {0x0F, 0x57}, XMM1, XMM1);
+			a.direct({0x66}, false, {0x0F, 0x2E}, XMM0, XMM1);
+		} else {
+			a.mem({0x66}, false, {0x0F, 0x2E}, XMM0, RBX, value_of(in.b));
+		}
+		set_flags(true);
+	}
+
+	// Generic instructions check types at runtime and pick the integer or floating template
+
+	void any_step(const instr &in, bool down)
+	{
+		a.mem({}, false, {0x8B}, RAX, RBX, type_of(in.a));
+		size_t floating = unless_int();
+		int_step(in, down);
+		size_t done = a.jmp();
+		a.bind(floating, a.size());
+		float_step(in, down);
+		a.bind(done, a.size());
+	}
+
+	void any_arith(size_t pc, const instr &in, arith kind)
+	{
+		check_same_type(pc, in);
+		if (kind == arith::mod) {
+			errors.push_back({unless_int(), pc, jit_invalid_type});
+			int_arith(in, kind);
+			return;
+		}
+		size_t floating = unless_int();
+		int_arith(in, kind);
+		size_t done = a.jmp();
+		a.bind(floating, a.size());
+		float_arith(in, kind);
+		a.bind(done, a.size());
+	}
+
+	void any_compare(size_t pc, const instr &in, bool zero)
+	{
+		if (zero)
+			a.mem({}, false, {0x8B}, RAX, RBX, type_of(in.a));
+		else
+			check_same_type(pc, in);
+		size_t floating = unless_int();
+		int_compare(in, zero);
+		size_t done = a.jmp();
+		a.bind(floating, a.size());
+		float_compare(in, zero);
+		a.bind(done, a.size());
+	}
+
+	void instruction(size_t pc)
+	{
+		const instr &in = ins[pc];
+		switch (in.code) {
+		case op::halt:
+			a.mov_imm(RAX, uint64_t(-1));
+			leave();
+			break;
+		case op::noop:
+			break;
+		case op::mov:
+			for (size_t off = 0; off < sizeof(var); off += 8) {
+				a.mem({}, true, {0x8B}, RAX, RBX, static_cast<int32_t>(in.a * sizeof(var) + off));
+				a.mem({}, true, {0x89}, RAX, RBX, static_cast<int32_t>(in.b * sizeof(var) + off));
+			}
+			break;
+		case op::push:
+			call(jit_push, pc);
+			leave_on_error();
+			break;
+		case op::upush:
+			call(jit_upush, in.a);
+			break;
+		case op::pop:
+			call(jit_pop, pc);
+			leave_on_error();
+			break;
+		case op::upop:
+			call(jit_upop, in.a);
+			break;
+
+		case op::inc: case op::inc_i: case op::inc_f:
+			any_step(in, false);
+			break;
+		case op::dec: case op::dec_i: case op::dec_f:
+			any_step(in, true);
+			break;
+		case op::add: case op::add_ii: case op::add_ff:
+			any_arith(pc, in, arith::add);
+			break;
+		case op::sub: case op::sub_ii: case op::sub_ff:
+			any_arith(pc, in, arith::sub);
+			break;
+		case op::mul: case op::mul_ii: case op::mul_ff:
+			any_arith(pc, in, arith::mul);
+			break;
+		case op::div: case op::div_ii: case op::div_ff:
+			any_arith(pc, in, arith::div);
+			break;
+		case op::mod: case op::mod_ii:
+			any_arith(pc, in, arith::mod);
+			break;
+		case op::cmp: case op::cmp_ii: case op::cmp_ff:
+			any_compare(pc, in, false);
+			break;
+		case op::cmpz: case op::cmpz_i: case op::cmpz_f:
+			any_compare(pc, in, true);
+			break;
+
+		case op::cil:
+			set_int(in.b, in.imm);
+			break;
+		case op::cfl: case op::cilw:
+			if (code.consts[in.imm].get_type() == var_type::integer)
+				set_int(in.b, code.consts[in.imm].as_int());
+			else
+				set_float(in.b, code.consts[in.imm].as_float());
+			break;
+
+		case op::ods:
+			call(jit_ods, in.imm);
+			break;
+		case op::ofv:
+			call(jit_ofv, in.a);
+			break;
+		case op::onl:
+			call(jit_onl, 0);
+			break;
+		case op::iiv:
+			call(jit_iiv, in.a);
+			break;
+		case op::ifv:
+			call(jit_ifv, in.a);
+			break;
+		case op::ipf:
+			call(jit_ipf, in.a);
+			break;
+
+		case op::iinc: int_step(in, false); break;
+		case op::finc: float_step(in, false); break;
+		case op::idec: int_step(in, true); break;
+		case op::fdec: float_step(in, true); break;
+		case op::iadd: int_arith(in, arith::add); break;
+		case op::fadd: float_arith(in, arith::add); break;
+		case op::isub: int_arith(in, arith::sub); break;
+		case op::fsub: float_arith(in, arith::sub); break;
+		case op::imul: int_arith(in, arith::mul); break;
+		case op::fmul: float_arith(in, arith::mul); break;
+		case op::idiv: int_arith(in, arith::div); break;
+		case op::fdiv: float_arith(in, arith::div); break;
+		case op::imod: int_arith(in, arith::mod); break;
+		case op::icmp: int_compare(in, false); break;
+		case op::fcmp: float_compare(in, false); break;
+		case op::icmpz: int_compare(in, true); break;
+		case op::fcmpz: float_compare(in, true); break;
+
+		// Superinstructions fall through past the instructions they were fused with
+		case op::icmp_jgt: case op::icmp_jeq: case op::icmp_jlt:
+			int_compare(in, false);
+			branch(fused_mask(in.code, op::icmp_jgt), in.imm);
+			jump_to(pc + 2);
+			break;
+		case op::fcmp_jgt: case op::fcmp_jeq: case op::fcmp_jlt:
+			float_compare(in, false);
+			branch(fused_mask(in.code, op::fcmp_jgt), in.imm);
+			jump_to(pc + 2);
+			break;
+		case op::icmpz_jgt: case op::icmpz_jeq: case op::icmpz_jlt:
+			int_compare(in, true);
+			branch(fused_mask(in.code, op::icmpz_jgt), in.imm);
+			jump_to(pc + 2);
+			break;
+		case op::fcmpz_jgt: case op::fcmpz_jeq: case op::fcmpz_jlt:
+			float_compare(in, true);
+			branch(fused_mask(in.code, op::fcmpz_jgt), in.imm);
+			jump_to(pc + 2);
+			break;
+		case op::iinc_icmp_jgt: case op::iinc_icmp_jeq: case op::iinc_icmp_jlt:
+			int_step(in, false);
+			int_compare(in, false);
+			branch(fused_mask(in.code, op::iinc_icmp_jgt), in.imm);
+			jump_to(pc + 3);
+			break;
+		case op::idec_icmp_jgt: case op::idec_icmp_jeq: case op::idec_icmp_jlt:
+			int_step(in, true);
+			int_compare(in, false);
+			branch(fused_mask(in.code, op::idec_icmp_jgt), in.imm);
+			jump_to(pc + 3);
+			break;
+
+		case op::jmp:
+			jump_to(in.imm);
+			break;
+		case op::jgt:
+			branch(VM_FLAG_GT, in.imm);
+			break;
+		case op::jeq:
+			branch(VM_FLAG_EQ, in.imm);
+			break;
+		case op::jlt:
+			branch(VM_FLAG_LT, in.imm);
+			break;
+		case op::call:
+			call(jit_call, pc);
+			leave_on_error();
+			jump_to(in.imm);
+			break;
+		case op::ucall:
+			call(jit_ucall, pc);
+			jump_to(in.imm);
+			break;
+		case op::ret:
+			call(jit_ret, pc);
+			leave_on_error();
+			// jmp [r13 + rax * 8]
+			a.emit({0x41, 0xFF, 0x64, 0xC5, 0x00});
+			break;
+		case op::uret:
+			call(jit_uret, pc);
+			a.emit({0x41, 0xFF, 0x64, 0xC5, 0x00});
+			break;
+		}
+	}
+
+	// Superinstructions come in groups of jgt, jeq and jlt variants
+	static uint8_t fused_mask(op o, op first)
+	{
+		static const uint8_t masks[] = {VM_FLAG_GT, VM_FLAG_EQ, VM_FLAG_LT};
+		return masks[static_cast<int>(o) - static_cast<int>(first)];
+	}
+
+public:
+	Compiler(const Code &code, const instr *ins)
+		: code(code), ins(ins), native(code.size())
+	{
+	}
+
+	// Returns false if the code can't be translated
+	bool compile(std::vector<uint8_t> &out, std::vector<size_t> &offsets)
+	{
+		// Prologue: save the registers the state is pinned to, align the stack and jump to the
+		// first instruction to run.
+		// push rbx; push r12; push r13; push r14; sub rsp, 8
+		a.emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x48, 0x83, 0xEC, 0x08});
+		a.direct({}, true, {0x89}, RDI, R12);
+		a.direct({}, true, {0x89}, RSI, RBX);
+		a.direct({}, true, {0x89}, RDX, R13);
+		a.direct({}, true, {0x89}, RCX, R14);
+		// jmp r8
+		a.emit({0x41, 0xFF, 0xE0});
+
+		for (size_t pc = 0; pc < code.size(); pc++) {
+			native[pc] = a.size();
+			instruction(pc);
+		}
+		// Running past the last instruction ends the program
+		a.mov_imm(RAX, uint64_t(-1));
+		leave();
+
+		for (auto &e : errors) {
+			a.bind(e.at, a.size());
+			call(e.report, e.pc);
+			a.mov_imm(RAX, uint64_t(-1));
+			leave();
+		}
+
+		// Epilogue: return the flags along with RAX
+		for (auto at : exits)
+			a.bind(at, a.size());
+		a.direct({}, true, {0x89}, R14, RDX);
+		// add rsp, 8; pop r14; pop r13; pop r12; pop rbx; ret
+		a.emit({0x48, 0x83, 0xC4, 0x08, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+
+		for (auto &b : branches) {
+			if (b.second >= native.size())
+				return false;
+			a.bind(b.first, native[b.second]);
+		}
+
+		out = std::move(a.bytes);
+		offsets = std::move(native);
+		return true;
+	}
+};
+
+#endif
+
+
+Jit::Jit(const Code &code, const instr *ins)
+	: code(code), buffer(nullptr), buffer_size(0)
+{
+#ifdef DTVM_JIT
+	std::vector<uint8_t> bytes;
+	std::vector<size_t> offsets;
+	if (!Compiler(code, ins).compile(bytes, offsets))
+		return;
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (bytes.size() + page - 1) / page * page;
+	void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return;
+	std::memcpy(mem, bytes.data(), bytes.size());
+	// Never writable and executable at the same time
+	if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, size);
+		return;
+	}
+
+	buffer = static_cast<uint8_t*>(mem);
+	buffer_size = size;
+	targets.reserve(offsets.size());
+	for (auto off : offsets)
+		targets.push_back(buffer + off);
+#else
+	(void)ins;
+#endif
+}
+
+
+Jit::~Jit()
+{
+#ifdef DTVM_JIT
+	if (buffer)
+		munmap(buffer, buffer_size);
+#endif
+}
+
+
+// Jit::ok
+// @ret - Whether the program was translated to native code
+bool Jit::ok() const
+{
+	return buffer != nullptr;
+}
+
+
+// Jit::run
+// Runs the native code from instruction `pc`, on `state`.
+// @arg state - State of the program, as left by the interpreter or a previous run
+// @arg pc    - Index of the first instruction to run
+// @ret - Index of the instruction to resume at, or -1 if the program ended
+int64_t Jit::run(vm_state &state, size_t pc) const
+{
+#ifdef DTVM_JIT
+	if (ok()) {
+		jit_runtime rt{state, code};
+		jit_entry entry = reinterpret_cast<jit_entry>(buffer);
+		jit_exit e = entry(&rt, state.reg.data(), targets.data(), state.flags, targets[pc]);
+		state.flags = e.flags;
+		return e.pc;
+	}
+#endif
+	(void)state;
+	return pc;
+}
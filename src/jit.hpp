@@ -0,0 +1,33 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <cinttypes>
+#include <vector>
+
+#include "code.hpp"
+#include "state.hpp"
+
+
+// Native code translated from a whole program, one template per instruction.
+// Only available on x86-64 Unix systems; `ok` tells whether the translation succeeded.
+class Jit {
+private:
+	const Code &code;
+	uint8_t *buffer;
+	size_t buffer_size;
+	// Address of the native code of each instruction
+	std::vector<const uint8_t*> targets;
+
+public:
+	// Translates `ins`, the instructions of `code` as the VM runs them, including rewritten ones
+	Jit(const Code &code, const instr *ins);
+	~Jit();
+
+	Jit(const Jit&) = delete;
+	Jit &operator=(const Jit&) = delete;
+
+	bool ok() const;
+	int64_t run(vm_state &state, size_t pc) const;
+};
@@ -1,22 +1,65 @@
 // Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
 // Licensed under the MIT License. See LICENSE file in the project root.
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <sstream>
+#include <vector>
 
 #include "args.hpp"
+#include "batch.hpp"
+#include "dtb.hpp"
+#include "dtvm.hpp"
 #include "error.hpp"
-#include "parser.hpp"
+#include "fuse.hpp"
 #include "vm.hpp"
 
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
 
 #ifndef VERSION
 #define VERSION "dev"
 #endif
 
 
+// write_bench
+// Writes the measurements of a run to `path` as a JSON object, for bench/run.py
+// @arg path         - Where to write them
+// @arg parse        - Time spent reading and preparing the code
+// @arg run          - Time spent running it
+// @arg instructions - Instructions run, or 0 if they weren't counted
+// @ret - Whether the file could be written
+static bool write_bench(const std::string &path, std::chrono::nanoseconds parse,
+	std::chrono::nanoseconds run, uint64_t instructions)
+{
+	std::ofstream file(path);
+	if (!file.is_open()) {
+		std::cerr << Error() << "Could not write file '" << path << "'" << std::endl;
+		return false;
+	}
+	long peak_rss_kb = 0;
+#ifdef __unix__
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		peak_rss_kb = usage.ru_maxrss;
+#endif
+	file << "{\"parse_ns\": " << parse.count() << ", \"run_ns\": " << run.count() <<
+		", \"instructions\": ";
+	if (instructions)
+		file << instructions << ", \"ns_per_instruction\": " <<
+			static_cast<double>(run.count()) / static_cast<double>(instructions);
+	else
+		file << "null, \"ns_per_instruction\": null";
+	file << ", \"peak_rss_kb\": " << peak_rss_kb << "}\n";
+	return file.good();
+}
+
+
 int main(int argc, char **argv)
 {
 	if (argc == 1) {
@@ -32,11 +75,17 @@ int main(int argc, char **argv)
 			return 0;
 		}
 
+		// In batch mode, the paths come before or between the flags
+		bool batch = std::string(argv[1]) == "batch";
+		std::vector<std::string> paths;
+
 		// Parse possible flags
 		for (int i = 2; i < argc; i++) {
 			std::string arg(argv[i]);
 
-			if (arg == "-no-ansi-color-codes" || arg == "-no-acc")
+			if (batch && arg[0] != '-')
+				paths.push_back(arg);
+			else if (arg == "-no-ansi-color-codes" || arg == "-no-acc")
 				dtvm_args::no_ansi_color_codes = true;
 			else if (arg == "-parse-and-print")
 				dtvm_args::parse_and_print = true;
@@ -44,6 +93,75 @@ int main(int argc, char **argv)
 				dtvm_args::debug = true;
 			else if (arg == "-show-data")
 				dtvm_args::show_data = true;
+			else if (arg == "-O")
+				dtvm_args::optimize = true;
+			else if (arg == "-jit")
+				dtvm_args::jit = true;
+			else if (arg == "-no-tier")
+				dtvm_args::tiering = false;
+			else if (arg == "-compile") {
+				if (i + 1 == argc) {
+					std::cerr << Error() << "Missing output file after `-compile`." << std::endl;
+					return 1;
+				}
+				dtvm_args::compile_path = argv[++i];
+			}
+			else if (arg.substr(0, 7) == "-flush=") {
+				std::string policy = arg.substr(7);
+				if (policy == "line")
+					dtvm_args::flush = flush_policy::line;
+				else if (policy == "full")
+					dtvm_args::flush = flush_policy::full;
+				else if (policy == "exit")
+					dtvm_args::flush = flush_policy::exit;
+				else {
+					std::cerr << Error() << "Invalid `-flush` argument." << std::endl;
+					return 1;
+				}
+			}
+			else if (arg.substr(0, 7) == "-stack=") {
+				std::stringstream tmp(arg.substr(7));
+				if (!(tmp >> dtvm_args::stack_size) || dtvm_args::stack_size == 0) {
+					std::cerr << Error() << "Invalid `-stack` argument." << std::endl;
+					return 1;
+				}
+			}
+			else if (arg.substr(0, 9) == "-threads=") {
+				std::stringstream tmp(arg.substr(9));
+				if (!(tmp >> dtvm_args::batch_threads) || dtvm_args::batch_threads == 0) {
+					std::cerr << Error() << "Invalid `-threads` argument." << std::endl;
+					return 1;
+				}
+			}
+			else if (arg == "-profile")
+				dtvm_args::profile_path = "profile.folded";
+			else if (arg.substr(0, 9) == "-profile=")
+				dtvm_args::profile_path = arg.substr(9);
+			else if (arg.substr(0, 7) == "-trace=")
+				dtvm_args::trace_path = arg.substr(7);
+			else if (arg.substr(0, 13) == "-trace-steps=") {
+				std::stringstream tmp(arg.substr(13));
+				if (!(tmp >> dtvm_args::trace_steps) || dtvm_args::trace_steps == 0) {
+					std::cerr << Error() << "Invalid `-trace-steps` argument." << std::endl;
+					return 1;
+				}
+			}
+			else if (arg.substr(0, 12) == "-show-trace=")
+				dtvm_args::show_trace_path = arg.substr(12);
+			else if (arg.substr(0, 7) == "-bench=")
+				dtvm_args::bench_path = arg.substr(7);
+			else if (arg.substr(0, 8) == "-sample=") {
+				std::stringstream tmp(arg.substr(8));
+				if (!(tmp >> dtvm_args::sample_hz) || dtvm_args::sample_hz == 0 ||
+					dtvm_args::sample_hz > 10000) {
+					std::cerr << Error() << "Invalid `-sample` argument." << std::endl;
+					return 1;
+				}
+			}
+			else if (arg == "-pin")
+				dtvm_args::pin_threads = true;
+			else if (arg == "-stats")
+				dtvm_args::batch_stats = true;
 			else if (arg.substr(0,2) == "-e")
 				dtvm_args::entry_point = arg.substr(2, arg.length());
 			else if (arg.substr(0,2) == "-r") {
@@ -57,33 +175,126 @@ int main(int argc, char **argv)
 						std::endl;
 					return 0;
 				}
+				if (dtvm_args::num_regs > max_num_regs) {
+					std::cerr << Error() << "Cannot set number of registers above " <<
+						max_num_regs << std::endl;
+					return 0;
+				}
 			} else
 				std::cout << Warn() << "Unknown option '" << argv[i] << "'" << std::endl;
 		}
 
-		// Attempt to open file
-		std::string file_path(argv[1]);
-		std::ifstream file(file_path);
-		if (!file.is_open()) {
-			std::cerr << Error() << "Could not open file '" << file_path << "'" << std::endl;
+		// Each of these runs the program under its own policy
+		int modes = !dtvm_args::profile_path.empty() + (dtvm_args::sample_hz != 0) +
+			!dtvm_args::trace_path.empty();
+		if (modes > 1) {
+			std::cerr << Error() <<
+				"Only one of -profile, -sample and -trace can be used at a time" << std::endl;
 			return 1;
 		}
 
-		// Parse code
-		auto code = parse(file, file_path);
-		if (code.size() == 0) {
-			std::cerr << Error() << "Got invalid code from parser" << std::endl;
+		if (batch) {
+			if (paths.size() == 1)
+				return run_batch("", paths[0]);
+			if (paths.size() == 2)
+				return run_batch(paths[0], paths[1]);
+			std::cerr << Error() << "Batch mode takes a manifest, optionally after a program" <<
+				std::endl;
 			return 1;
 		}
 
+		const bool bench = !dtvm_args::bench_path.empty();
+		const auto start = std::chrono::steady_clock::now();
+
+		// Precompiled code went through every pass but fusion when it was written
+		Code code = dtvm::read(argv[1], dtvm_args::optimize);
+		if (code.size() == 0)
+			return 1;
+
+		// If the program was called with -compile, just save the resolved code
+		if (!dtvm_args::compile_path.empty())
+			return write_dtb(code, dtvm_args::compile_path) ? 0 : 1;
+
+		// Debug mode shows every instruction as it runs, so keep sequences apart there
+		if (!dtvm_args::debug)
+			fuse(code);
+
 		// If the program was called with -parse-and-print, just pretty print the parsed bytecode.
 		if (dtvm_args::parse_and_print) {
 			std::cout << code;
 			return 0;
 		}
 
-		// Run the code in the VM
-		execute(code);
+		// If the program was called with -show-trace, print the steps recorded from this code
+		if (!dtvm_args::show_trace_path.empty())
+			return show_trace(dtvm_args::show_trace_path, code, std::cout) ? 0 : 1;
+
+		const auto parsed = std::chrono::steady_clock::now();
+
+		// Run the code in the VM, natively with -jit
+		if (dtvm_args::jit) {
+			if (dtvm_args::debug)
+				std::cerr << Warn() << "-jit is ignored in debug mode" << std::endl;
+			else if (!dtvm_args::profile_path.empty() || dtvm_args::sample_hz)
+				std::cerr << Warn() << "-jit is ignored when profiling" << std::endl;
+			else if (!dtvm_args::trace_path.empty())
+				std::cerr << Warn() << "-jit is ignored when tracing" << std::endl;
+		}
+		dtvm::Options options;
+		options.num_regs = dtvm_args::num_regs;
+		options.debug = dtvm_args::debug;
+		options.tiering = dtvm_args::tiering;
+		options.native = dtvm_args::jit;
+		options.stack_size = dtvm_args::stack_size;
+		options.flush = dtvm_args::flush;
+		// Counting is only free when everything stays in the interpreter anyway
+		options.count_instructions = bench && !dtvm_args::tiering && !dtvm_args::jit;
+		auto program = std::make_shared<const Code>(std::move(code));
+		if (!dtvm_args::profile_path.empty()) {
+			std::ofstream file(dtvm_args::profile_path);
+			if (!file.is_open()) {
+				std::cerr << Error() << "Could not write file '" << dtvm_args::profile_path << "'" <<
+					std::endl;
+				return 1;
+			}
+			Profile profile(*program);
+			options.profile = &profile;
+			dtvm::VM vm(program, options);
+			vm.run();
+			profile.write_collapsed(file);
+			profile.write_summary(std::cerr);
+			return 0;
+		}
+		if (dtvm_args::sample_hz) {
+			Sampler sampler(*program, dtvm_args::sample_hz);
+			options.sampler = &sampler;
+			dtvm::VM vm(program, options);
+			if (!sampler.start())
+				return 1;
+			vm.run();
+			sampler.stop();
+			sampler.report(std::cerr);
+			return 0;
+		}
+		if (!dtvm_args::trace_path.empty()) {
+			Trace trace(*program, dtvm_args::trace_steps);
+			if (!trace.open(dtvm_args::trace_path))
+				return 1;
+			options.trace = &trace;
+			dtvm::VM vm(program, options);
+			vm.run();
+			if (!trace.write()) {
+				std::cerr << Error() << "Could not write file '" << dtvm_args::trace_path << "'" <<
+					std::endl;
+				return 1;
+			}
+			return 0;
+		}
+		dtvm::VM vm(program, options);
+		vm.run();
+		if (bench && !write_bench(dtvm_args::bench_path, parsed - start,
+			std::chrono::steady_clock::now() - parsed, vm.instructions()))
+			return 1;
 	}
 
 	return 0;
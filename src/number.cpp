@@ -0,0 +1,76 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "number.hpp"
+
+#include <charconv>
+#include <cstdlib>
+#include <limits>
+#include <string>
+
+
+// read_integer
+// @exported
+// Reads a decimal integer with an optional sign, accepting exactly what `std::istream` accepts
+// @arg s   - Text to read from
+// @arg pos - Where the number starts. Moved past it if it was read.
+// @arg v   - Receives the number
+// @ret - Whether a number that fits in `v` was read
+bool read_integer(std::string_view s, size_t &pos, int64_t &v)
+{
+	const char *first = s.data() + pos;
+	const char *last = s.data() + s.size();
+	if (first != last && *first == '+' && first + 1 != last && is_digit(first[1]))
+		first++;
+	auto result = std::from_chars(first, last, v);
+	if (result.ec != std::errc())
+		return false;
+	pos = result.ptr - s.data();
+	return true;
+}
+
+
+// read_floating
+// @exported
+// Reads a floating point number. The characters `std::istream` would take as part of the number
+// are collected first, and must all convert.
+// @arg s   - Text to read from
+// @arg pos - Where the number starts. Moved past the collected characters, even on failure.
+// @arg v   - Receives the number
+// @ret - Whether a finite number was read
+bool read_floating(std::string_view s, size_t &pos, double &v)
+{
+	size_t start = pos;
+	if (pos < s.size() && (s[pos] == '+' || s[pos] == '-'))
+		pos++;
+	bool found_mantissa = false, found_dec = false, found_sci = false;
+	while (pos < s.size()) {
+		char c = s[pos];
+		if (is_digit(c)) {
+			found_mantissa = true;
+		} else if (c == '.' && !found_dec && !found_sci) {
+			found_dec = true;
+		} else if ((c == 'e' || c == 'E') && !found_sci && found_mantissa) {
+			found_sci = true;
+			if (pos + 1 < s.size() && (s[pos + 1] == '+' || s[pos + 1] == '-'))
+				pos++;
+		} else {
+			break;
+		}
+		pos++;
+	}
+
+	const char *first = s.data() + start;
+	const char *last = s.data() + pos;
+	if (first != last && *first == '+')
+		first++;
+	auto result = std::from_chars(first, last, v);
+	if (result.ec == std::errc::result_out_of_range && result.ptr == last) {
+		// Streams only reject overflows. Underflows keep whatever strtod rounds them to.
+		std::string literal(first, last);
+		v = std::strtod(literal.c_str(), nullptr);
+		return v != std::numeric_limits<double>::infinity() &&
+			v != -std::numeric_limits<double>::infinity();
+	}
+	return result.ec == std::errc() && result.ptr == last;
+}
@@ -0,0 +1,22 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <cinttypes>
+#include <string_view>
+
+
+// Whitespace, as `std::istream` skips it in the "C" locale
+inline bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+bool read_integer(std::string_view s, size_t &pos, int64_t &v);
+bool read_floating(std::string_view s, size_t &pos, double &v);
@@ -14,22 +14,56 @@ std::ostream &operator<<(std::ostream &os, op const &o)
 	case op::mov:
 		return os << "mov ";
 	case op::push:
+	case op::upush:
 		return os << "push";
 	case op::pop:
+	case op::upop:
 		return os << "pop ";
 	case op::inc:
+	case op::inc_i:
+	case op::inc_f:
+	case op::iinc:
+	case op::finc:
+	case op::iinc_icmp_jgt:
+	case op::iinc_icmp_jeq:
+	case op::iinc_icmp_jlt:
 		return os << "inc ";
 	case op::dec:
+	case op::dec_i:
+	case op::dec_f:
+	case op::idec:
+	case op::fdec:
+	case op::idec_icmp_jgt:
+	case op::idec_icmp_jeq:
+	case op::idec_icmp_jlt:
 		return os << "dec ";
 	case op::add:
+	case op::add_ii:
+	case op::add_ff:
+	case op::iadd:
+	case op::fadd:
 		return os << "add ";
 	case op::sub:
+	case op::sub_ii:
+	case op::sub_ff:
+	case op::isub:
+	case op::fsub:
 		return os << "sub ";
 	case op::mul:
+	case op::mul_ii:
+	case op::mul_ff:
+	case op::imul:
+	case op::fmul:
 		return os << "mul ";
 	case op::div:
+	case op::div_ii:
+	case op::div_ff:
+	case op::idiv:
+	case op::fdiv:
 		return os << "div ";
 	case op::mod:
+	case op::mod_ii:
+	case op::imod:
 		return os << "mod ";
 	case op::cil:
 		return os << "cil ";
@@ -48,8 +82,28 @@ std::ostream &operator<<(std::ostream &os, op const &o)
 	case op::ipf:
 		return os << "ipf ";
 	case op::cmp:
+	case op::cmp_ii:
+	case op::cmp_ff:
+	case op::icmp:
+	case op::fcmp:
+	case op::icmp_jgt:
+	case op::icmp_jeq:
+	case op::icmp_jlt:
+	case op::fcmp_jgt:
+	case op::fcmp_jeq:
+	case op::fcmp_jlt:
 		return os << "cmp ";
 	case op::cmpz:
+	case op::cmpz_i:
+	case op::cmpz_f:
+	case op::icmpz:
+	case op::fcmpz:
+	case op::icmpz_jgt:
+	case op::icmpz_jeq:
+	case op::icmpz_jlt:
+	case op::fcmpz_jgt:
+	case op::fcmpz_jeq:
+	case op::fcmpz_jlt:
 		return os << "cmpz";
 	case op::jmp:
 		return os << "jmp ";
@@ -60,8 +114,12 @@ std::ostream &operator<<(std::ostream &os, op const &o)
 	case op::jlt:
 		return os << "jlt ";
 	case op::call:
+	case op::ucall:
 		return os << "call";
 	case op::ret:
+	case op::uret:
 		return os << "ret";
+	case op::cilw:
+		return os << "cil ";
 	}
 }
@@ -3,11 +3,13 @@
 
 #pragma once
 
+#include <cinttypes>
+#include <cstddef>
 #include <ostream>
 
 
 // Enumeration of the VM instructions
-enum class op {
+enum class op : uint8_t {
 	halt, // Halts execution of the VM
 	noop, // No operations happens
 
@@ -45,8 +47,87 @@ enum class op {
 
 	call, // Jumps to a label
 	ret,  // Go back to the instruction after the last ret called
+
+	// Instructions below are only produced by the loader and have no source syntax
+
+	cilw, // Copy integer literal from the constant pool to r1 (`cil` with a wide literal)
+
+	// Stack instructions the depth analysis proved safe, so they never check the stack depth
+
+	upush, // `push` where the stack always has room left
+	upop,  // `pop` where the stack is never empty
+	ucall, // `call` where the callstack always has room left
+	uret,  // `ret` where the callstack is never empty
+
+	// Quickened instructions. The VM rewrites a generic instruction into its typed variant the
+	// first time it runs, and back into the generic one if the operand types ever change.
+
+	inc_i,  // `inc` on an integer
+	inc_f,  // `inc` on a floating point
+	dec_i,  // `dec` on an integer
+	dec_f,  // `dec` on a floating point
+	add_ii, // `add` on two integers
+	add_ff, // `add` on two floating points
+	sub_ii, // `sub` on two integers
+	sub_ff, // `sub` on two floating points
+	mul_ii, // `mul` on two integers
+	mul_ff, // `mul` on two floating points
+	div_ii, // `div` on two integers
+	div_ff, // `div` on two floating points
+	mod_ii, // `mod` on two integers
+	cmp_ii, // `cmp` on two integers
+	cmp_ff, // `cmp` on two floating points
+	cmpz_i, // `cmpz` on an integer
+	cmpz_f, // `cmpz` on a floating point
+
+	// Statically typed instructions. The type inference pass emits these where the operand types
+	// are the same on every path reaching the instruction, so they never check types.
+
+	iinc,   // `inc` on an integer
+	finc,   // `inc` on a floating point
+	idec,   // `dec` on an integer
+	fdec,   // `dec` on a floating point
+	iadd,   // `add` on two integers
+	fadd,   // `add` on two floating points
+	isub,   // `sub` on two integers
+	fsub,   // `sub` on two floating points
+	imul,   // `mul` on two integers
+	fmul,   // `mul` on two floating points
+	idiv,   // `div` on two integers
+	fdiv,   // `div` on two floating points
+	imod,   // `mod` on two integers
+	icmp,   // `cmp` on two integers
+	fcmp,   // `cmp` on two floating points
+	icmpz,  // `cmpz` on an integer
+	fcmpz,  // `cmpz` on a floating point
+
+	// Superinstructions. The loader fuses a statically typed comparison with the conditional jump
+	// after it, leaving the original instructions in place for code that jumps between them.
+
+	icmp_jgt,      // `icmp` followed by `jgt`
+	icmp_jeq,      // `icmp` followed by `jeq`
+	icmp_jlt,      // `icmp` followed by `jlt`
+	fcmp_jgt,      // `fcmp` followed by `jgt`
+	fcmp_jeq,      // `fcmp` followed by `jeq`
+	fcmp_jlt,      // `fcmp` followed by `jlt`
+	icmpz_jgt,     // `icmpz` followed by `jgt`
+	icmpz_jeq,     // `icmpz` followed by `jeq`
+	icmpz_jlt,     // `icmpz` followed by `jlt`
+	fcmpz_jgt,     // `fcmpz` followed by `jgt`
+	fcmpz_jeq,     // `fcmpz` followed by `jeq`
+	fcmpz_jlt,     // `fcmpz` followed by `jlt`
+	iinc_icmp_jgt, // `iinc r1` followed by `icmp r1 r2` and `jgt`
+	iinc_icmp_jeq, // `iinc r1` followed by `icmp r1 r2` and `jeq`
+	iinc_icmp_jlt, // `iinc r1` followed by `icmp r1 r2` and `jlt`
+	idec_icmp_jgt, // `idec r1` followed by `icmp r1 r2` and `jgt`
+	idec_icmp_jeq, // `idec r1` followed by `icmp r1 r2` and `jeq`
+	idec_icmp_jlt, // `idec r1` followed by `icmp r1 r2` and `jlt`
 };
 
+// Number of operations, including the ones only created by the loader
+constexpr size_t num_ops = static_cast<size_t>(op::idec_icmp_jlt) + 1;
+
 
-// Makes `op` enumerations printable
+// Makes `op` enumerations printable. Quickened, statically typed and unchecked instructions print
+// as their generic form, and superinstructions as their first instruction.
 std::ostream &operator<<(std::ostream &os, op const &o);
@@ -0,0 +1,299 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "optimize.hpp"
+
+#include <vector>
+
+
+// Every pass only ever removes or simplifies instructions, this just bounds the work on
+// pathological inputs
+static const int max_rounds = 16;
+
+// Register sets used by the liveness analysis, one bit per register
+typedef std::vector<uint64_t> reg_set;
+
+
+// find_targets
+// Marks the instructions execution may arrive at other than by falling through from the one
+// before: jump targets, return sites and the entry point.
+// @arg code - The code
+// @ret - One entry per instruction, true for the ones marked
+static std::vector<bool> find_targets(const Code &code)
+{
+	std::vector<bool> targets(code.size(), false);
+	targets[code.entry_point] = true;
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		if (has_target(code[pc].code))
+			targets[code[pc].imm] = true;
+		if (code[pc].code == op::call)
+			targets[pc + 1] = true;
+	}
+	return targets;
+}
+
+
+// thread_jumps
+// Retargets jumps and calls that land on a `jmp` to the final destination of the `jmp` chain.
+// @arg code - The code
+// @ret - Whether anything changed
+static bool thread_jumps(Code &code)
+{
+	bool changed = false;
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		if (!has_target(code[pc].code))
+			continue;
+		auto target = code[pc].imm;
+		// Bounded so that `jmp` cycles don't loop forever
+		for (size_t hops = 0; code[target].code == op::jmp && hops < code.size(); hops++)
+			target = code[target].imm;
+		if (target != code[pc].imm) {
+			code[pc].imm = target;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+
+// peephole
+// Removes instructions that have no effect and simplifies adjacent pairs.
+// @arg code - The code
+// @ret - Whether anything changed
+static bool peephole(Code &code)
+{
+	const auto targets = find_targets(code);
+	std::vector<bool> removed(code.size(), false);
+	bool changed = false;
+
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		auto &ins = code[pc];
+
+		const bool jumps_to_next = (ins.code == op::jmp || ins.code == op::jgt ||
+		                            ins.code == op::jeq || ins.code == op::jlt) &&
+		                           size_t(ins.imm) == pc + 1;
+		if (ins.code == op::noop || (ins.code == op::mov && ins.a == ins.b) || jumps_to_next) {
+			removed[pc] = true;
+			changed = true;
+			continue;
+		}
+
+		// The patterns below look at pairs that are always executed together
+		if (pc + 1 >= code.size() || targets[pc + 1] || removed[pc])
+			continue;
+		auto &next = code[pc + 1];
+
+		if (ins.code == op::push && next.code == op::pop) {
+			// `push r1; pop r2` is `mov r1 r2`, which is then removed if r1 == r2
+			removed[pc] = true;
+			next = instr{op::mov, ins.a, next.a, 0};
+			changed = true;
+		} else if (ins.code == op::mov && next.code == op::mov && next.a == ins.b) {
+			// `mov r1 r2; mov r2 r3` is `mov r1 r2; mov r1 r3`. The first one is removed later if
+			// r2 is dead, and the second one if r1 == r3.
+			next.a = ins.a;
+			changed = true;
+		} else if (ins.code == op::mov && next.code == op::mov && next.a == ins.a &&
+		           next.b == ins.b) {
+			removed[pc + 1] = true;
+			changed = true;
+		}
+	}
+
+	if (changed)
+		code.remove(removed);
+	return changed;
+}
+
+
+// uses_and_defs
+// Collects the registers an instruction reads and the ones it always overwrites.
+// @arg ins  - The instruction
+// @arg uses - Set where the registers read are added
+// @arg defs - Set where the registers overwritten are added
+static void uses_and_defs(const instr &ins, reg_set &uses, reg_set &defs)
+{
+	const auto add = [](reg_set &s, uint16_t r) { s[r / 64] |= uint64_t(1) << (r % 64); };
+
+	switch (ins.code) {
+	// Reads r1, and writes it back for `inc` and `dec`
+	case op::push:
+	case op::ofv:
+	case op::cmpz:
+	case op::inc:
+	case op::dec:
+		add(uses, ins.a);
+		break;
+
+	// Reads r1 and r2, and possibly writes r2
+	case op::add:
+	case op::sub:
+	case op::mul:
+	case op::div:
+	case op::mod:
+	case op::cmp:
+		add(uses, ins.a);
+		add(uses, ins.b);
+		break;
+
+	case op::mov:
+		add(uses, ins.a);
+		add(defs, ins.b);
+		break;
+
+	case op::cil:
+	case op::cfl:
+	case op::cilw:
+		add(defs, ins.b);
+		break;
+
+	case op::pop:
+	case op::ipf:
+		add(defs, ins.a);
+		break;
+
+	// `iiv` and `ifv` leave the register untouched when reading fails, so they don't define it
+	default:
+		break;
+	}
+}
+
+
+// successors
+// Collects the instructions that may run right after instruction `pc`.
+// @arg code         - The code
+// @arg pc           - Index of the instruction
+// @arg return_sites - Index of the instruction following each `call`
+// @arg succ         - Vector where the successors are appended
+static void successors(const Code &code, size_t pc, const std::vector<size_t> &return_sites,
+                       std::vector<size_t> &succ)
+{
+	const auto &ins = code[pc];
+	switch (ins.code) {
+	case op::halt:
+		break;
+	case op::jmp:
+	case op::call:
+		succ.push_back(ins.imm);
+		break;
+	case op::jgt:
+	case op::jeq:
+	case op::jlt:
+		succ.push_back(ins.imm);
+		succ.push_back(pc + 1);
+		break;
+	case op::ret:
+		succ.insert(succ.end(), return_sites.begin(), return_sites.end());
+		break;
+	default:
+		succ.push_back(pc + 1);
+		break;
+	}
+}
+
+
+// remove_dead_writes
+// Computes which registers are live after each instruction and removes the instructions whose
+// only effect is writing to a dead register.
+// @arg code - The code
+// @ret - Whether anything changed
+static bool remove_dead_writes(Code &code)
+{
+	const auto words = (num_used_regs(code) + 63) / 64;
+	if (words == 0)
+		return false;
+
+	std::vector<size_t> return_sites;
+	for (size_t pc = 0; pc < code.size(); pc++)
+		if (code[pc].code == op::call)
+			return_sites.push_back(pc + 1);
+
+	std::vector<std::vector<size_t>> preds(code.size());
+	std::vector<size_t> succ;
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		succ.clear();
+		successors(code, pc, return_sites, succ);
+		for (auto s : succ)
+			preds[s].push_back(pc);
+	}
+
+	// Backwards dataflow: live_in = uses | (live_out & ~defs), live_out = union of successors'
+	std::vector<reg_set> uses(code.size(), reg_set(words, 0));
+	std::vector<reg_set> defs(code.size(), reg_set(words, 0));
+	for (size_t pc = 0; pc < code.size(); pc++)
+		uses_and_defs(code[pc], uses[pc], defs[pc]);
+
+	std::vector<reg_set> live_in(code.size(), reg_set(words, 0));
+	std::vector<reg_set> live_out(code.size(), reg_set(words, 0));
+	std::vector<size_t> worklist;
+	for (size_t pc = 0; pc < code.size(); pc++)
+		worklist.push_back(pc);
+
+	while (!worklist.empty()) {
+		const auto pc = worklist.back();
+		worklist.pop_back();
+
+		bool changed = false;
+		for (size_t w = 0; w < words; w++) {
+			const auto in = uses[pc][w] | (live_out[pc][w] & ~defs[pc][w]);
+			if (in != live_in[pc][w]) {
+				live_in[pc][w] = in;
+				changed = true;
+			}
+		}
+		if (!changed)
+			continue;
+		for (auto p : preds[pc]) {
+			for (size_t w = 0; w < words; w++)
+				live_out[p][w] |= live_in[pc][w];
+			worklist.push_back(p);
+		}
+	}
+
+	std::vector<bool> removed(code.size(), false);
+	bool changed = false;
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		const auto &ins = code[pc];
+		uint16_t dest;
+		switch (ins.code) {
+		case op::mov:
+		case op::cil:
+		case op::cfl:
+		case op::cilw:
+			dest = ins.b;
+			break;
+		case op::ipf:
+			dest = ins.a;
+			break;
+		default:
+			continue;
+		}
+		if (!(live_out[pc][dest / 64] & (uint64_t(1) << (dest % 64)))) {
+			removed[pc] = true;
+			changed = true;
+		}
+	}
+
+	if (changed)
+		code.remove(removed);
+	return changed;
+}
+
+
+// optimize
+// @exported
+// Peephole and liveness based optimizations over freshly parsed code. Removes `noop`s, redundant
+// `mov`s and matching `push`/`pop` pairs, drops literal and `mov` writes to dead registers and
+// threads jumps that land on other `jmp`s. Jump targets and the entry point are updated to the
+// new instruction indices.
+// @arg code - The code to optimize in place. Must not contain loader-only instructions other
+//             than `cilw`.
+void optimize(Code &code)
+{
+	bool changed = true;
+	for (int round = 0; changed && round < max_rounds; round++) {
+		changed = thread_jumps(code);
+		changed |= peephole(code);
+		changed |= remove_dead_writes(code);
+	}
+}
@@ -0,0 +1,17 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include "code.hpp"
+
+
+// optimize
+// @exported
+// Peephole and liveness based optimizations over freshly parsed code. Removes `noop`s, redundant
+// `mov`s and matching `push`/`pop` pairs, drops literal and `mov` writes to dead registers and
+// threads jumps that land on other `jmp`s. Jump targets and the entry point are updated to the
+// new instruction indices.
+// @arg code - The code to optimize in place. Must not contain loader-only instructions other
+//             than `cilw`.
+void optimize(Code &code);
@@ -0,0 +1,137 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "output.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+
+// Size at which the buffer is written out, unless the policy is `exit`
+constexpr size_t output_block_size = 1 << 16;
+
+// Longest output of `std::to_chars` for an int64_t or a double in general format with precision 6
+constexpr size_t max_value_length = 32;
+
+
+// Write to `sink`, or to stdout if it's null. Anything already written to `std::cout` goes out
+// first.
+Output::Output(flush_policy policy, OutputSink *sink)
+	: policy(policy), sink(sink)
+{
+	buffer.reserve(output_block_size);
+	if (!sink)
+		std::cout.flush();
+}
+
+
+// Whatever is still buffered is written out when the program ends
+Output::~Output()
+{
+	flush();
+}
+
+
+// Output::reset
+// Writes out what's buffered, then sends the rest of the output to `sink`, or to stdout if it's
+// null
+void Output::reset(OutputSink *sink)
+{
+	flush();
+	this->sink = sink;
+}
+
+
+// Makes room for `n` more characters, writing the buffer out first if it would grow past a block
+void Output::reserve(size_t n)
+{
+	if (policy != flush_policy::exit && buffer.size() + n > output_block_size)
+		flush();
+}
+
+
+// Outputs a string as it is
+void Output::write(std::string_view s)
+{
+	reserve(s.size());
+	buffer.insert(buffer.end(), s.begin(), s.end());
+	if (policy == flush_policy::line && std::memchr(s.data(), '\n', s.size()))
+		flush();
+}
+
+
+// Outputs a value formatted like `std::ostream` does by default: integers in decimal, and
+// floating point values like `printf("%g")`
+void Output::write(const var &v)
+{
+	reserve(max_value_length);
+	size_t size = buffer.size();
+	buffer.resize(size + max_value_length);
+	char *first = buffer.data() + size;
+	char *last = buffer.data() + buffer.size();
+	std::to_chars_result result;
+	if (v.get_type() == var_type::integer)
+		result = std::to_chars(first, last, v.as_int());
+	else
+		result = std::to_chars(first, last, v.as_float(), std::chars_format::general, 6);
+	buffer.resize(result.ptr - buffer.data());
+}
+
+
+// Outputs a single character
+void Output::put(char c)
+{
+	reserve(1);
+	buffer.push_back(c);
+}
+
+
+// Ends the current line
+void Output::newline()
+{
+	put('\n');
+	if (policy == flush_policy::line)
+		flush();
+}
+
+
+// Called before the program reads from stdin, so prompts show up when output is line buffered
+void Output::before_input()
+{
+	if (policy == flush_policy::line)
+		flush();
+}
+
+
+// Writes out everything buffered so far. Errors are ignored, like `std::cout` does.
+void Output::flush()
+{
+	const char *data = buffer.data();
+	size_t left = buffer.size();
+	if (sink) {
+		if (left > 0)
+			sink->write(data, left);
+		buffer.clear();
+		return;
+	}
+#ifdef __unix__
+	while (left > 0) {
+		ssize_t written = ::write(STDOUT_FILENO, data, left);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			break;
+		data += written;
+		left -= written;
+	}
+#else
+	std::cout.write(data, left).flush();
+#endif
+	buffer.clear();
+}
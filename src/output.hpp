@@ -0,0 +1,57 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "var.hpp"
+
+
+// When buffered program output is written out
+enum class flush_policy {
+	// At every line break, and before reading input
+	line,
+	// Whenever the buffer fills up
+	full,
+	// Only when the program ends
+	exit,
+};
+
+
+// Receives the output of a program, for programs that don't write to stdout
+class OutputSink {
+public:
+	virtual ~OutputSink() = default;
+
+	// Takes the next `size` characters of output
+	virtual void write(const char *data, size_t size) = 0;
+};
+
+
+// Buffered output of a running program, to an `OutputSink` or stdout. Values are formatted with `std::to_chars` into
+// the same bytes `std::ostream` would produce, and written out in blocks with `write(2)`.
+class Output {
+private:
+	std::vector<char> buffer;
+	flush_policy policy;
+	OutputSink *sink;
+
+	void reserve(size_t n);
+
+public:
+	Output(flush_policy policy, OutputSink *sink);
+	~Output();
+
+	Output(const Output&) = delete;
+	Output &operator=(const Output&) = delete;
+
+	void reset(OutputSink *sink);
+	void write(std::string_view s);
+	void write(const var &v);
+	void put(char c);
+	void newline();
+	void before_input();
+	void flush();
+};
@@ -3,28 +3,187 @@
 
 #include "parser.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
-
+#include <thread>
 #include <utility>
-#include <map>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "args.hpp"
 #include "error.hpp"
+#include "number.hpp"
+#include "symbols.hpp"
+
+
+// Lexer
+// A cursor over a single line of source. Tokens are views into the source, and literals are
+// converted in place, so nothing is allocated. Tokens and literals end exactly where extraction
+// from a `std::istream` would make them end, which the diagnostics depend on.
+// Diagnostics about the line go to `out` and `err` instead of stdout and stderr, since lines may be
+// parsed out of order.
+class Lexer {
+private:
+	std::string_view line;
+	size_t pos;
+	// Set once reading a raw character hits the end of the line, after which nothing is read
+	bool failed;
+
+	void skip_space()
+	{
+		while (pos < line.size() && is_space(line[pos]))
+			pos++;
+	}
+
+public:
+	std::ostream &out;
+	std::ostream &err;
+
+	Lexer(std::string_view line, std::ostream &out, std::ostream &err)
+		: line(line), pos(0), failed(false), out(out), err(err)
+	{
+	}
+
+	// Reads the next whitespace separated token. `t` is left untouched if there is none.
+	bool token(std::string_view &t)
+	{
+		if (failed)
+			return false;
+		skip_space();
+		size_t start = pos;
+		while (pos < line.size() && !is_space(line[pos]))
+			pos++;
+		if (start == pos)
+			return false;
+		t = line.substr(start, pos - start);
+		return true;
+	}
+
+	// Reads a decimal integer, with an optional sign
+	bool integer(int64_t &v)
+	{
+		if (failed)
+			return false;
+		skip_space();
+		return read_integer(line, pos, v);
+	}
+
+	// Reads a floating point number
+	bool floating(double &v)
+	{
+		if (failed)
+			return false;
+		skip_space();
+		return read_floating(line, pos, v);
+	}
+
+	// Reads the next character that isn't whitespace
+	bool character(char &c)
+	{
+		if (failed)
+			return false;
+		skip_space();
+		if (pos == line.size())
+			return false;
+		c = line[pos++];
+		return true;
+	}
+
+	// Reads the next character, whatever it is
+	bool get(char &c)
+	{
+		if (failed || pos == line.size()) {
+			failed = true;
+			return false;
+		}
+		c = line[pos++];
+		return true;
+	}
+};
+
+
+// A jump or call whose target label is resolved once the whole source has been read
+struct label_ref {
+	// Instruction to patch
+	size_t index;
+	// Label referenced
+	uint32_t symbol;
+	// Line of the reference, for error reporting
+	int line;
+};
+
+
+// What happened while parsing a chunk of lines, whose outcome depends on the lines before the
+// chunk. Events are replayed in source order once every chunk has been parsed.
+enum class event_kind : uint8_t {
+	message,     // Message `index` was printed to stderr
+	message_out, // Message `index` was printed to stdout
+	fatal,       // Parsing stopped after the previous message
+	label,       // Label `symbol` was defined at instruction `index`
+	sublabel,    // Like `label`, but `symbol` still needs the context label of previous chunks
+	data,        // String `symbol` was defined as string `index`
+	ods,         // String `symbol` was used by instruction `index`
+	ref,         // Label `symbol` was referenced by instruction `index`
+	subref,      // Like `ref`, but `symbol` still needs the context label of previous chunks
+};
+
+struct event {
+	event_kind kind;
+	// In the symbol table of the chunk
+	uint32_t symbol;
+	// Instruction, string or message index, all within the chunk
+	uint32_t index;
+	int line;
+};
+
+
+// A range of whole lines parsed on its own
+struct chunk {
+	std::string_view text;
+	// Number of lines before the chunk
+	int line_offset = 0;
+	// Instructions, constants and strings. Indices are relative to the chunk.
+	Code code;
+	SymbolTable symbols;
+	std::vector<event> events;
+	std::vector<std::string> messages;
+	// Last label that wasn't a sublabel, if there was any
+	std::string_view context_label;
+	bool has_context = false;
+};
+
+
+// Entry of `v` for symbol `id`, which is -1 until set
+static int64_t &entry(std::vector<int64_t> &v, uint32_t id)
+{
+	if (id >= v.size())
+		v.resize(id + 1, -1);
+	return v[id];
+}
+
+
+// First character of a token, or '\0' for an empty one
+static char first(std::string_view token)
+{
+	return token.empty() ? '\0' : token[0];
+}
 
 
 // get_int
-// Tries to get an integer from the stringstream and prints out an error on failure.
-// @arg ss - stringstream which the token must originate from
+// Tries to get an integer from the line and prints out an error on failure.
+// @arg lx - Lexer over the line the token must originate from
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
 // @ret - Second value reports true if there was an error and the first on is the integer
 //        value if the second value is false.
-std::pair<int64_t, bool> get_int(std::stringstream &ss, const std::string &sn, const int &ln) {
+std::pair<int64_t, bool> get_int(Lexer &lx, const std::string &sn, const int &ln) {
 	int64_t integer_token;
-	ss >> integer_token;
-	if (ss.fail()) {
-		std::cerr << Error() << "Invalid integer literal in " << sn << '.' << ln << std::endl;
+	if (!lx.integer(integer_token)) {
+		lx.err << Error() << "Invalid integer literal in " << sn << '.' << ln << std::endl;
 		return std::pair<int64_t, bool>(0, true);
 	}
 	return std::pair<int64_t, bool>(integer_token, false);
@@ -32,22 +191,21 @@ std::pair<int64_t, bool> get_int(std::stringstream &ss, const std::string &sn, c
 
 
 // get_reg
-// Tries to get an integer from the stringstream that represents a register index, and prints
-// out an error on failure.
-// @arg ss - stringstream which the token must originate from
+// Tries to get an integer from the line that represents a register index, and prints out an
+// error on failure.
+// @arg lx - Lexer over the line the token must originate from
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
 // @ret - Second value reports true if there was an error and the first on is the index
 //        number if the second value is false.
-std::pair<int64_t, bool> get_reg(std::stringstream &ss, const std::string &sn, const int &ln) {
+std::pair<int64_t, bool> get_reg(Lexer &lx, const std::string &sn, const int &ln) {
 	int64_t integer_token;
-	ss >> integer_token;
-	if (ss.fail()) {
-		std::cerr << Error() << "Invalid register literal in " << sn << '.' << ln << std::endl;
+	if (!lx.integer(integer_token)) {
+		lx.err << Error() << "Invalid register literal in " << sn << '.' << ln << std::endl;
 		return std::pair<int64_t, bool>(0, true);
 	}
 	if (integer_token < 0 || integer_token >= dtvm_args::num_regs) {
-		std::cerr << Error() << "Invalid register " << integer_token << " at " << sn << '.' <<
+		lx.err << Error() << "Invalid register " << integer_token << " at " << sn << '.' <<
 			ln << ". Should be within range [0," << dtvm_args::num_regs <<  ')' << std::endl;
 		return std::pair<int64_t, bool>(0, true);
 	}
@@ -56,18 +214,16 @@ std::pair<int64_t, bool> get_reg(std::stringstream &ss, const std::string &sn, c
 
 
 // get_float
-// Tries to get a floating number from the stringstream that represents a register index, and
-// prints out an error on failure.
-// @arg ss - stringstream which the token must originate from
+// Tries to get a floating number from the line, and prints out an error on failure.
+// @arg lx - Lexer over the line the token must originate from
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
 // @ret - Second value reports true if there was an error and the first on is the floating
 //        point number if the second value is false.
-std::pair<double, bool> get_float(std::stringstream &ss, const std::string &sn, const int &ln) {
+std::pair<double, bool> get_float(Lexer &lx, const std::string &sn, const int &ln) {
 	double float_token;
-	ss >> float_token;
-	if (ss.fail()) {
-		std::cerr << Error() << "Invalid register literal in " << sn << '.' << ln << std::endl;
+	if (!lx.floating(float_token)) {
+		lx.err << Error() << "Invalid register literal in " << sn << '.' << ln << std::endl;
 		return std::pair<double, bool>(0., true);
 	}
 	return std::pair<double, bool>(float_token, false);
@@ -75,20 +231,20 @@ std::pair<double, bool> get_float(std::stringstream &ss, const std::string &sn,
 
 
 // check_empty
-// Checks if the stringstream is semantically empty and prints an error otherwise.
-// @arg ss - stringstream which the token must originate from
+// Checks if the rest of the line is semantically empty and prints an error otherwise.
+// @arg lx - Lexer over the line
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
-// @ret - Returns true if the stringstream is not semantically empty.
-bool check_empty(std::stringstream &ss, const std::string &sn, const int &ln)
+// @ret - Returns true if the line is not semantically empty.
+bool check_empty(Lexer &lx, const std::string &sn, const int &ln)
 {
-	std::string token;
-	if (ss >> token) {
+	std::string_view token;
+	if (lx.token(token)) {
 		// Allow comments
 		if (token[0] == ';')
 			return false;
 
-		std::cerr << Error() << "Expected newline but found '" << token << "' in " <<
+		lx.err << Error() << "Expected newline but found '" << token << "' in " <<
 			sn << '.' << ln << std::endl;
 		return true;
 	}
@@ -97,25 +253,25 @@ bool check_empty(std::stringstream &ss, const std::string &sn, const int &ln)
 
 
 // parse_reg_reg
-// Modular parsing block to fetch two register tokens from the stringstream
-// @arg ss - stringstream which the token must originate from
+// Modular parsing block to fetch two register tokens from the line
+// @arg lx - Lexer over the line the token must originate from
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
-// @arg c  - Code object to push the parsed values into
+// @arg c  - Code object whose last instruction receives the parsed operands
 // @ret - Returns true if there was an error.
-bool parse_reg_reg(std::stringstream &ss, const std::string &sn, const int &ln, Code &c)
+bool parse_reg_reg(Lexer &lx, const std::string &sn, const int &ln, Code &c)
 {
-	auto tmp1 = get_reg(ss, sn, ln);
+	auto tmp1 = get_reg(lx, sn, ln);
 	if (tmp1.second)
 		return true;
-	c.push_int(tmp1.first);
+	c.back().a = static_cast<uint16_t>(tmp1.first);
 
-	auto tmp2 = get_reg(ss, sn, ln);
+	auto tmp2 = get_reg(lx, sn, ln);
 	if (tmp2.second)
 		return true;
-	c.push_int(tmp2.first);
+	c.back().b = static_cast<uint16_t>(tmp2.first);
 
-	if (check_empty(ss, sn, ln))
+	if (check_empty(lx, sn, ln))
 		return true;
 
 	return false;
@@ -123,25 +279,25 @@ bool parse_reg_reg(std::stringstream &ss, const std::string &sn, const int &ln,
 
 
 // parse_int_reg
-// Modular parsing block to fetch an integer and a register token from the stringstream
-// @arg ss - stringstream which the token must originate from
+// Modular parsing block to fetch an integer and a register token from the line
+// @arg lx - Lexer over the line the token must originate from
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
-// @arg c  - Code object to push the parsed values into
+// @arg c  - Code object whose last instruction receives the parsed operands
 // @ret - Returns true if there was an error.
-bool parse_int_reg(std::stringstream &ss, const std::string &sn, const int &ln, Code &c)
+bool parse_int_reg(Lexer &lx, const std::string &sn, const int &ln, Code &c)
 {
-	auto tmp1 = get_int(ss, sn, ln);
+	auto tmp1 = get_int(lx, sn, ln);
 	if (tmp1.second)
 		return true;
-	c.push_int(tmp1.first);
+	c.set_int(tmp1.first);
 
-	auto tmp2 = get_reg(ss, sn, ln);
+	auto tmp2 = get_reg(lx, sn, ln);
 	if (tmp2.second)
 		return true;
-	c.push_int(tmp2.first);
+	c.back().b = static_cast<uint16_t>(tmp2.first);
 
-	if (check_empty(ss, sn, ln))
+	if (check_empty(lx, sn, ln))
 		return true;
 
 	return false;
@@ -149,25 +305,25 @@ bool parse_int_reg(std::stringstream &ss, const std::string &sn, const int &ln,
 
 
 // parse_flt_reg
-// Modular parsing block to fetch a floating point and a register token from the stringstream
-// @arg ss - stringstream which the token must originate from
+// Modular parsing block to fetch a floating point and a register token from the line
+// @arg lx - Lexer over the line the token must originate from
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
-// @arg c  - Code object to push the parsed values into
+// @arg c  - Code object whose last instruction receives the parsed operands
 // @ret - Returns true if there was an error.
-bool parse_flt_reg(std::stringstream &ss, const std::string &sn, const int &ln, Code &c)
+bool parse_flt_reg(Lexer &lx, const std::string &sn, const int &ln, Code &c)
 {
-	auto tmp1 = get_float(ss, sn, ln);
+	auto tmp1 = get_float(lx, sn, ln);
 	if (tmp1.second)
 		return true;
-	c.push_float(tmp1.first);
+	c.set_float(tmp1.first);
 
-	auto tmp2 = get_reg(ss, sn, ln);
+	auto tmp2 = get_reg(lx, sn, ln);
 	if (tmp2.second)
 		return true;
-	c.push_int(tmp2.first);
+	c.back().b = static_cast<uint16_t>(tmp2.first);
 
-	if (check_empty(ss, sn, ln))
+	if (check_empty(lx, sn, ln))
 		return true;
 
 	return false;
@@ -175,20 +331,20 @@ bool parse_flt_reg(std::stringstream &ss, const std::string &sn, const int &ln,
 
 
 // parse_int_reg
-// Modular parsing block to fetch a register token from the stringstream
-// @arg ss - stringstream which the token must originate from
+// Modular parsing block to fetch a register token from the line
+// @arg lx - Lexer over the line the token must originate from
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
-// @arg c  - Code object to push the parsed values into
+// @arg c  - Code object whose last instruction receives the parsed operands
 // @ret - Returns true if there was an error.
-bool parse_reg(std::stringstream &ss, const std::string &sn, const int &ln, Code &c)
+bool parse_reg(Lexer &lx, const std::string &sn, const int &ln, Code &c)
 {
-	auto tmp1 = get_reg(ss, sn, ln);
+	auto tmp1 = get_reg(lx, sn, ln);
 	if (tmp1.second)
 		return true;
-	c.push_int(tmp1.first);
+	c.back().a = static_cast<uint16_t>(tmp1.first);
 
-	if (check_empty(ss, sn, ln))
+	if (check_empty(lx, sn, ln))
 		return true;
 
 	return false;
@@ -196,50 +352,51 @@ bool parse_reg(std::stringstream &ss, const std::string &sn, const int &ln, Code
 
 
 // parse_lab
-// Modular parsing block to fetch a label token from the stringstream
-// @arg ss - stringstream which the token must originate from
+// Modular parsing block to fetch a label token from the line
+// @arg lx - Lexer over the line the token must originate from
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
-// @arg c  - Code object to push the parsed values into
-// @arg m  - Map to store the information regarding the label reference
+// @arg c  - Code object whose last instruction receives the parsed operands
+// @arg ch - Chunk being parsed, which records the reference
 // @ret - Returns true if there was an error.
-bool parse_lab(std::stringstream &ss, const std::string &sn, const int &ln, Code &c,
-               std::map<int64_t, std::pair<int, std::string>> &m, const std::string &cl)
+bool parse_lab(Lexer &lx, const std::string &sn, const int &ln, Code &c, chunk &ch)
 {
-	std::string token;
-	ss >> token;
-
-	// If it's a sublabel, expand it
-	if (token[0] == '.')
-		token = cl + token;
-
-	m[c.size()] = std::pair<int, std::string>(ln, token);
+	std::string_view token;
+	lx.token(token);
+
+	// If it's a sublabel, expand it, unless the context label is in a previous chunk
+	auto index = static_cast<uint32_t>(c.size() - 1);
+	if (first(token) != '.')
+		ch.events.push_back(event{event_kind::ref, ch.symbols.intern(token), index, ln});
+	else if (ch.has_context)
+		ch.events.push_back(event{event_kind::ref, ch.symbols.intern(ch.context_label, token),
+			index, ln});
+	else
+		ch.events.push_back(event{event_kind::subref, ch.symbols.intern(token), index, ln});
 
 	// Add a filler
-	c.push_int(-1);
+	c.back().imm = -1;
 
-	if (check_empty(ss, sn, ln))
+	if (check_empty(lx, sn, ln))
 		return true;
 	return false;
 }
 
 
 // gfc
-// Gets a formatted character from the stringstream
-// @arg ss - The stringstream
+// Gets a formatted character from the line
+// @arg lx - Lexer over the line
 // @arg sn - File name for error reporting
 // @arg ln - Line number for error reporting
 // @ret (Character, Was there any error?)
-std::pair<char, bool> gfc(std::stringstream &ss, const std::string &sn, const int &ln)
+std::pair<char, bool> gfc(Lexer &lx, const std::string &sn, const int &ln)
 {
 	char ch;
-	ch = ss.get();
-	if (ss.fail())
+	if (!lx.get(ch))
 		return std::pair<char, bool>('\0', true);
 	if (ch == '\\') {
-		ch = ss.get();
-		if (ss.fail()) {
-			std::cerr << Error() << "Expected \\ expansion at " << sn << '.' << ln <<
+		if (!lx.get(ch)) {
+			lx.err << Error() << "Expected \\ expansion at " << sn << '.' << ln <<
 				"but found EOL instead." << std::endl;
 			return std::pair<char, bool>('\0', true);
 		}
@@ -249,7 +406,7 @@ std::pair<char, bool> gfc(std::stringstream &ss, const std::string &sn, const in
 		case 'n':
 			return std::pair<char, bool>('\n', false);
 		default:
-			std::cerr << Error() << "Expected valid \\ expansion at " << sn << '.' << ln <<
+			lx.err << Error() << "Expected valid \\ expansion at " << sn << '.' << ln <<
 				"but found invalid expanding character '" << ch << "'" << std::endl;
 			return std::pair<char, bool>(ch, true);
 		}
@@ -258,279 +415,483 @@ std::pair<char, bool> gfc(std::stringstream &ss, const std::string &sn, const in
 }
 
 
-// parse
-// @exported
-// Parses the source file into a Code object
-// @arg src      - The ifstream holding the source file
-// @arg src_name - The name of the source file for error reporting
-// @ret - The Code object. An empty Code object is returned on error.
-Code parse(std::ifstream& src, std::string& src_name)
+// Parses one line into the chunk, recording what can only be resolved once the previous chunks
+// are known
+// @arg line - The line, without the line break
+// @arg lx   - Lexer over the line
+// @arg sn   - Source name for error reporting
+// @arg ln   - Line number for error reporting
+// @arg ch   - Chunk the line belongs to
+// @ret - Returns false if parsing must stop.
+static bool parse_line(Lexer &lx, const std::string &sn, const int &ln, chunk &ch)
 {
-	Code code;
-	int line_num = 0;
-	std::string line;
+	Code &code = ch.code;
 
-	std::string context_label = "";
+	std::string_view token;
+	lx.token(token);
 
-	// Holds the strings of the labels and the index they reference
-	std::map<std::string, int64_t> label_dict;
-	// Holds the index the label reference appears mapping to the line number it appear and to the
-	// name of the label referenced
-	std::map<int64_t, std::pair<int, std::string>> label_refs;
+	// Check if line is a comment
+	// The other possibility of a comment is handled by `check_empty`
+	if (first(token) == ';')
+		return true;
 
-	// Holds the name of a string and its index
-	std::map<std::string, int> data_dict;
 
-	while (std::getline(src, line)) {
-		line_num++;
+	// Check if it's a constant string
+	if (token == "data") {
+		lx.token(token);
+		// Redefinitions are checked when merging, before anything else on the line is reported
+		ch.events.push_back(event{event_kind::data, ch.symbols.intern(token),
+			static_cast<uint32_t>(code.data.size()), ln});
 
-		if (line.empty())
-			continue;
+		// Make sure next character is a "
+		char ch_token = '\0';
+		lx.character(ch_token);
+		if (ch_token != '"') {
+			lx.out << Error() << "Expected '\"' but found " << ch_token << " at " <<
+				sn << '.' << ln << std::endl;
+			return false;
+		}
 
-		std::stringstream line_stream(line);
+		auto tmp = gfc(lx, sn, ln);
+		std::string new_data;
+		while (!tmp.second && tmp.first != '"') {
+			new_data += tmp.first;
+			tmp = gfc(lx, sn, ln);
+		}
+		if (tmp.second) {
+			lx.err << Error() << "Failed to parse string at " << sn << '.' << ln << std::endl;
+		}
+		code.data.push_back(std::move(new_data));
+		// Make sure line is empty
+		return !check_empty(lx, sn, ln);
+	}
 
-		std::string token;
-		line_stream >> token;
+	// Check if line is a label
+	if (!token.empty() && token.back() == ':') {
+		auto label_name = token.substr(0, token.length() - 1);
+		auto index = static_cast<uint32_t>(code.size());
+		// Check if it's a sublabel in need of expansion
+		if (first(label_name) == '.') {
+			if (!ch.has_context) {
+				// The context label is in a previous chunk, if anywhere
+				ch.events.push_back(event{event_kind::sublabel, ch.symbols.intern(label_name),
+					index, ln});
+			} else if (ch.context_label.empty()) {
+				lx.err << Error() << "Sublabel without context label '" << label_name <<
+					"' at " << sn << '.' << ln << std::endl;
+				return false;
+			} else {
+				ch.events.push_back(event{event_kind::label,
+					ch.symbols.intern(ch.context_label, label_name), index, ln});
+			}
+		} else {
+			ch.context_label = label_name;
+			ch.has_context = true;
+			ch.events.push_back(event{event_kind::label, ch.symbols.intern(label_name), index, ln});
+		}
+		// Make sure line is empty after label
+		return !check_empty(lx, sn, ln);
+	}
 
-		// Check if line is a comment
-		// The other possibility of a comment is handled by `check_empty`
-		if (token[0] == ';')
-			continue;
 
+	// Try to match an instruction and error otherwisde
 
-		// Check if it's a constant string
-		if (token == "data") {
-			line_stream >> token;
-			// Check if string_name already exists
-			auto const find = data_dict.find(token);
-			if (find != data_dict.end()) {
-				std::cout << Error() << "Invalid string redefinition at " << src_name << '.' <<
-					line_num << std::endl;
-				return Code();
-			}
-			data_dict[token] = code.data.size();
-
-			// Make sure next character is a "
-			char ch_token;
-			line_stream >> ch_token;
-			if (ch_token != '"') {
-				std::cout << Error() << "Expected '\"' but found " << ch_token << " at " <<
-					src_name << '.' << line_num << std::endl;
-				return Code();
-			}
+	if (token == "halt") {
+		code.push_op(op::halt);
+		if (check_empty(lx, sn, ln))
+			return false;
 
-			auto tmp = gfc(line_stream, src_name, line_num);
-			std::ostringstream new_data;
-			while (!tmp.second && tmp.first != '"') {
-				new_data << tmp.first;
-				tmp = gfc(line_stream, src_name, line_num);
-			}
-			if (tmp.second) {
-				std::cerr << Error() << "Failed to parse string at " << src_name << '.' <<
-					line_num << std::endl;
-			}
-			code.data.push_back(new_data.str());
-			// Make sure line is empty
-			if (check_empty(line_stream, src_name, line_num))
-				return Code();
-			continue;
-		}
+	} else if (token == "noop") {
+		code.push_op(op::noop);
+		if (check_empty(lx, sn, ln))
+			return false;
 
-		// Check if line is a label
-		if (token.back() == ':') {
-			auto label_name = token.substr(0, token.length() - 1);
-			// Check if it's a sublabel in need of expansion
-			if (label_name[0] == '.') {
-				// Check if it's a valid sublabel
-				if (context_label.empty()) {
-					std::cerr << Error() << "Sublabel without context label '" << label_name <<
-						"' at " << src_name << '.' << line_num << std::endl;
-					return Code();
-				}
-				// Expand sublabel
-				label_name = context_label + label_name;
-			} else {
-				context_label = label_name;
-			}
-			// Check for label redefinitions
-			auto const tmp = label_dict.find(label_name);
-			if (tmp != label_dict.end()) {
-				std::cout << Error() << "Invalid label redefinition at " << src_name << '.' <<
-					line_num << std::endl;
-				return Code();
-			}
-			label_dict[label_name] = code.size();
-			if (label_name == dtvm_args::entry_point)
-				code.entry_point = code.size();
-			// Make sure line is empty after label
-			if (check_empty(line_stream, src_name, line_num))
-				return Code();
-			continue;
-		}
+	} else if (token == "mov") {
+		code.push_op(op::mov);
+		if (parse_reg_reg(lx, sn, ln, code))
+			return false;
 
+	} else if (token == "push") {
+		code.push_op(op::push);
+		if (parse_reg(lx, sn, ln, code))
+			return false;
 
-		// Try to match an instruction and error otherwisde
+	} else if (token == "pop") {
+		code.push_op(op::pop);
+		if (parse_reg(lx, sn, ln, code))
+			return false;
 
-		if (token == "halt") {
-			code.push_op(op::halt);
-			if (check_empty(line_stream, src_name, line_num))
-				return Code();
+	} else if (token == "inc") {
+		code.push_op(op::inc);
+		if (parse_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "noop") {
-			code.push_op(op::noop);
-			if (check_empty(line_stream, src_name, line_num))
-				return Code();
+	} else if (token == "dec") {
+		code.push_op(op::dec);
+		if (parse_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "mov") {
-			code.push_op(op::mov);
-			if (parse_reg_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "add") {
+		code.push_op(op::add);
+		if (parse_reg_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "push") {
-			code.push_op(op::push);
-			if (parse_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "sub") {
+		code.push_op(op::sub);
+		if (parse_reg_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "pop") {
-			code.push_op(op::pop);
-			if (parse_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "mul") {
+		code.push_op(op::mul);
+		if (parse_reg_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "inc") {
-			code.push_op(op::inc);
-			if (parse_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "div") {
+		code.push_op(op::div);
+		if (parse_reg_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "dec") {
-			code.push_op(op::dec);
-			if (parse_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "mod") {
+		code.push_op(op::mod);
+		if (parse_reg_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "add") {
-			code.push_op(op::add);
-			if (parse_reg_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "cil") {
+		code.push_op(op::cil);
+		if (parse_int_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "sub") {
-			code.push_op(op::sub);
-			if (parse_reg_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "cfl") {
+		code.push_op(op::cfl);
+		if (parse_flt_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "mul") {
-			code.push_op(op::mul);
-			if (parse_reg_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "ods") {
+		code.push_op(op::ods);
+		lx.token(token);
+		// The string may be defined in a previous chunk, so it's looked up when merging
+		ch.events.push_back(event{event_kind::ods, ch.symbols.intern(token),
+			static_cast<uint32_t>(code.size() - 1), ln});
+		if (check_empty(lx, sn, ln))
+			return false;
 
-		} else if (token == "div") {
-			code.push_op(op::div);
-			if (parse_reg_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "ofv") {
+		code.push_op(op::ofv);
+		if (parse_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "mod") {
-			code.push_op(op::mod);
-			if (parse_reg_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "onl") {
+		code.push_op(op::onl);
+		if (check_empty(lx, sn, ln))
+			return false;
 
-		} else if (token == "cil") {
-			code.push_op(op::cil);
-			if (parse_int_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "iiv") {
+		code.push_op(op::iiv);
+		if (parse_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "cfl") {
-			code.push_op(op::cfl);
-			if (parse_flt_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "ifv") {
+		code.push_op(op::ifv);
+		if (parse_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "ods") {
-			code.push_op(op::ods);
-			line_stream >> token;
-			// Attempt to find token in data dict
-			if (data_dict.find(token) == data_dict.end()) {
-				std::cerr << Error() << "Undefined data label '" << token << "' at " <<
-					src_name << '.' << line_num << std::endl;
-				return Code();
-			} else {
-				code.push_int(data_dict.find(token)->second);
-			}
-			if (check_empty(line_stream, src_name, line_num))
-				return Code();
+	} else if (token == "ipf") {
+		code.push_op(op::ipf);
+		if (parse_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "ofv") {
-			code.push_op(op::ofv);
-			if (parse_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "cmp") {
+		code.push_op(op::cmp);
+		if (parse_reg_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "onl") {
-			code.push_op(op::onl);
-			if (check_empty(line_stream, src_name, line_num))
-				return Code();
+	} else if (token == "cmpz" || token == "cmz") {
+		code.push_op(op::cmpz);
+		if (parse_reg(lx, sn, ln, code))
+			return false;
 
-		} else if (token == "iiv") {
-			code.push_op(op::iiv);
-			if (parse_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "jmp") {
+		code.push_op(op::jmp);
+		if (parse_lab(lx, sn, ln, code, ch))
+			return false;
 
-		} else if (token == "ifv") {
-			code.push_op(op::ifv);
-			if (parse_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "jgt") {
+		code.push_op(op::jgt);
+		if (parse_lab(lx, sn, ln, code, ch))
+			return false;
 
-		} else if (token == "ipf") {
-			code.push_op(op::ipf);
-			if (parse_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "jeq") {
+		code.push_op(op::jeq);
+		if (parse_lab(lx, sn, ln, code, ch))
+			return false;
 
-		} else if (token == "cmp") {
-			code.push_op(op::cmp);
-			if (parse_reg_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token == "jlt") {
+		code.push_op(op::jlt);
+		if (parse_lab(lx, sn, ln, code, ch))
+			return false;
 
-		} else if (token == "cmpz" || token == "cmz") {
-			code.push_op(op::cmpz);
-			if (parse_reg(line_stream, src_name, line_num, code))
-				return Code();
+	} else if (token  == "call") {
+		code.push_op(op::call);
+		if (parse_lab(lx, sn, ln, code, ch))
+			return false;
 
-		} else if (token == "jmp") {
-			code.push_op(op::jmp);
-			if (parse_lab(line_stream, src_name, line_num, code, label_refs, context_label))
-				return Code();
+	} else if (token == "ret") {
+		code.push_op(op::ret);
+		if (check_empty(lx, sn, ln))
+			return false;
 
-		} else if (token == "jgt") {
-			code.push_op(op::jgt);
-			if (parse_lab(line_stream, src_name, line_num, code, label_refs, context_label))
-				return Code();
+	} else {
+		lx.err << Error() << "Unkown instruction '" << token << "' in " <<
+		            sn << '.' << ln << std::endl;
+		return false;
+	}
 
-		} else if (token == "jeq") {
-			code.push_op(op::jeq);
-			if (parse_lab(line_stream, src_name, line_num, code, label_refs, context_label))
-				return Code();
+	return true;
+}
 
-		} else if (token == "jlt") {
-			code.push_op(op::jlt);
-			if (parse_lab(line_stream, src_name, line_num, code, label_refs, context_label))
-				return Code();
 
-		} else if (token  == "call") {
-			code.push_op(op::call);
-			if (parse_lab(line_stream, src_name, line_num, code, label_refs, context_label))
-				return Code();
+// Moves whatever the lexer printed for the current line into the chunk's messages
+static void collect_messages(chunk &ch, std::ostringstream &out, std::ostringstream &err)
+{
+	if (err.tellp() > 0) {
+		ch.events.push_back(event{event_kind::message, 0,
+			static_cast<uint32_t>(ch.messages.size()), 0});
+		ch.messages.push_back(err.str());
+		err.str("");
+	}
+	if (out.tellp() > 0) {
+		ch.events.push_back(event{event_kind::message_out, 0,
+			static_cast<uint32_t>(ch.messages.size()), 0});
+		ch.messages.push_back(out.str());
+		out.str("");
+	}
+}
 
-		} else if (token == "ret") {
-			code.push_op(op::ret);
-			if (check_empty(line_stream, src_name, line_num))
-				return Code();
 
-		} else {
-			std::cerr << Error() << "Unkown instruction '" << token << "' in " <<
-			             src_name << '.' << line_num << std::endl;
-			return Code();
+// Parses every line of a chunk, stopping at the first error
+// @arg ch - The chunk, with `text` and `line_offset` set
+// @arg sn - Source name for error reporting
+static void parse_chunk(chunk &ch, const std::string &sn)
+{
+	std::ostringstream out, err;
+	int line_num = ch.line_offset;
+	size_t line_start = 0;
+
+	while (line_start < ch.text.size()) {
+		size_t line_end = ch.text.find('\n', line_start);
+		if (line_end == std::string_view::npos)
+			line_end = ch.text.size();
+		auto line = ch.text.substr(line_start, line_end - line_start);
+		line_start = line_end + 1;
+		line_num++;
+
+		if (line.empty())
+			continue;
+
+		Lexer line_lexer(line, out, err);
+		bool ok = parse_line(line_lexer, sn, line_num, ch);
+		ch.code.lines.resize(ch.code.size(), line_num);
+		collect_messages(ch, out, err);
+		if (!ok) {
+			ch.events.push_back(event{event_kind::fatal, 0, 0, line_num});
+			return;
+		}
+	}
+}
+
+
+// Counts the line breaks in `text`, 16 or 32 bytes at a time where the target allows it
+static size_t count_lines(std::string_view text)
+{
+	const char *p = text.data();
+	const char *end = p + text.size();
+	size_t count = 0;
+#if defined(__AVX2__)
+	const __m256i newline = _mm256_set1_epi8('\n');
+	for (; end - p >= 32; p += 32) {
+		__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline)));
+		count += __builtin_popcount(mask);
+	}
+#elif defined(__SSE2__)
+	const __m128i newline = _mm_set1_epi8('\n');
+	for (; end - p >= 16; p += 16) {
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+	}
+#endif
+	for (; p != end; p++)
+		count += *p == '\n';
+	return count;
+}
+
+
+// Runs `f(i)` for every `i` below `n`, on a thread each. The calling thread takes `i = 0`.
+template <typename F>
+static void for_each_thread(size_t n, F f)
+{
+	std::vector<std::thread> threads;
+	threads.reserve(n - 1);
+	for (size_t i = 1; i < n; i++)
+		threads.emplace_back(f, i);
+	f(0);
+	for (auto &t : threads)
+		t.join();
+}
+
+
+// Sources smaller than this per thread aren't worth splitting
+constexpr size_t min_chunk_size = 1 << 20;
+
+
+// Splits the source into at most one chunk per core, each ending right after a line break
+static std::vector<chunk> split(std::string_view src)
+{
+	size_t n = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(),
+		src.size() / min_chunk_size));
+	std::vector<chunk> chunks(n);
+	size_t start = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t end = src.size();
+		if (i + 1 < n) {
+			end = src.find('\n', std::max(start, src.size() * (i + 1) / n));
+			end = end == std::string_view::npos ? src.size() : end + 1;
+		}
+		chunks[i].text = src.substr(start, end - start);
+		start = end;
+	}
+
+	// Chunks need the number of lines before them for error messages
+	std::vector<size_t> lines(n);
+	for_each_thread(n, [&](size_t i) { lines[i] = count_lines(chunks[i].text); });
+	for (size_t i = 1; i < n; i++)
+		chunks[i].line_offset = chunks[i - 1].line_offset + static_cast<int>(lines[i - 1]);
+	return chunks;
+}
+
+
+// parse
+// @exported
+// Parses the source file into a Code object. Large sources are split into chunks of whole lines
+// which are parsed in parallel, then merged in order. Whatever depends on previous lines (the
+// context label of sublabels, strings being defined before use, redefinitions and the messages
+// printed) is settled while merging, so the outcome is the same as parsing line by line.
+// @arg src      - The whole source file
+// @arg src_name - The name of the source file for error reporting
+// @ret - The Code object. An empty Code object is returned on error.
+Code parse(std::string_view src, const std::string &src_name)
+{
+	auto chunks = split(src);
+	for_each_thread(chunks.size(), [&](size_t i) { parse_chunk(chunks[i], src_name); });
+
+	Code code;
+	std::vector<instr> instrs;
+
+	// Last label that wasn't a sublabel, as it appears in the source
+	std::string_view context_label;
+
+	// Label and string names. Sublabels are interned already expanded.
+	SymbolTable symbols;
+	// Index of the instruction each label refers to, by symbol
+	std::vector<int64_t> label_index;
+	// Label references, in the order they appear
+	std::vector<label_ref> label_refs;
+	// Index of each string in the data section, by symbol
+	std::vector<int64_t> data_index;
+
+	for (auto &ch : chunks) {
+		const size_t instr_base = instrs.size();
+		const size_t const_base = code.consts.size();
+		const size_t data_base = code.data.size();
+		for (size_t i = 0; i < ch.code.size(); i++) {
+			instr in = ch.code[i];
+			if (in.code == op::cfl || in.code == op::cilw)
+				in.imm += static_cast<int32_t>(const_base);
+			instrs.push_back(in);
+		}
+		code.lines.insert(code.lines.end(), ch.code.lines.begin(), ch.code.lines.end());
+		code.consts.insert(code.consts.end(), ch.code.consts.begin(), ch.code.consts.end());
+		for (auto &d : ch.code.data)
+			code.data.push_back(std::move(d));
+
+		for (auto &e : ch.events) {
+			auto name = ch.symbols.name(e.symbol);
+			const size_t index = instr_base + e.index;
+			switch (e.kind) {
+			case event_kind::message:
+				std::cerr << ch.messages[e.index] << std::flush;
+				break;
+			case event_kind::message_out:
+				std::cout << ch.messages[e.index] << std::flush;
+				break;
+			case event_kind::fatal:
+				return Code();
+			case event_kind::label:
+			case event_kind::sublabel: {
+				uint32_t symbol;
+				if (e.kind == event_kind::label) {
+					symbol = symbols.intern(name);
+				} else if (context_label.empty()) {
+					std::cerr << Error() << "Sublabel without context label '" << name <<
+						"' at " << src_name << '.' << e.line << std::endl;
+					return Code();
+				} else {
+					symbol = symbols.intern(context_label, name);
+				}
+				// Check for label redefinitions
+				int64_t &label = entry(label_index, symbol);
+				if (label >= 0) {
+					std::cout << Error() << "Invalid label redefinition at " << src_name << '.' <<
+						e.line << std::endl;
+					return Code();
+				}
+				label = index;
+				code.labels.push_back(code_label{std::string(symbols.name(symbol)),
+					static_cast<int>(index)});
+				if (symbols.name(symbol) == dtvm_args::entry_point)
+					code.entry_point = index;
+				break;
+			}
+			case event_kind::data: {
+				// Check if string_name already exists
+				int64_t &data = entry(data_index, symbols.intern(name));
+				if (data >= 0) {
+					std::cout << Error() << "Invalid string redefinition at " << src_name << '.' <<
+						e.line << std::endl;
+					return Code();
+				}
+				data = data_base + e.index;
+				break;
+			}
+			case event_kind::ods: {
+				// Attempt to find token in data dict
+				int64_t data = entry(data_index, symbols.intern(name));
+				if (data < 0) {
+					std::cerr << Error() << "Undefined data label '" << name << "' at " <<
+						src_name << '.' << e.line << std::endl;
+					return Code();
+				}
+				instrs[index].imm = static_cast<int32_t>(data);
+				break;
+			}
+			case event_kind::ref:
+				label_refs.push_back(label_ref{index, symbols.intern(name), e.line});
+				break;
+			case event_kind::subref:
+				label_refs.push_back(label_ref{index, symbols.intern(context_label, name), e.line});
+				break;
+			}
 		}
+		if (ch.has_context)
+			context_label = ch.context_label;
 	}
+	code.assign(instrs.data(), instrs.size());
 
 	// Always make sure to push a halt at the end
 	// 1. This avoids empty Code object when an empty source is given
 	// 2. This makes it so a label at the end of a file points to something meaningful
 	code.push_op(op::halt);
+	code.lines.push_back(0);
 
 	if (code.entry_point < 0) {
 		std::cerr << Error() << "The entry point label '" << dtvm_args::entry_point  <<
@@ -538,19 +899,16 @@ Code parse(std::ifstream& src, std::string& src_name)
 		return Code();
 	}
 
-	// Go thorugh label references and use the label dictionary to substitute the proper
-	// 'addresses' where they were referenced.
+	// Go thorugh label references in one pass and substitute the proper 'addresses' where they
+	// were referenced.
 	for (auto &ref : label_refs) {
-		const auto index_to_change = ref.first;
-		const auto referenced_label = ref.second.second;
-		const auto find_result = label_dict.find(referenced_label);
-		if (find_result == label_dict.end()) {
-			std::cerr << Error() << "Unknown label '" << referenced_label << '\'' <<
-				" in " << src_name << '.' << ref.second.first << std::endl;
+		const auto referenced_index = entry(label_index, ref.symbol);
+		if (referenced_index < 0) {
+			std::cerr << Error() << "Unknown label '" << symbols.name(ref.symbol) << '\'' <<
+				" in " << src_name << '.' << ref.line << std::endl;
 			return Code();
 		}
-		const auto referenced_index = find_result->second;
-		code[index_to_change] = referenced_index;
+		code[ref.index].imm = static_cast<int32_t>(referenced_index);
 	}
 
 	return code;
@@ -3,8 +3,8 @@
 
 #pragma once
 
-#include <fstream>
 #include <string>
+#include <string_view>
 
 #include "code.hpp"
 
@@ -12,7 +12,7 @@
 // parse
 // @exported
 // Parses the source file into a Code object
-// @arg src      - The ifstream holding the source file
+// @arg src      - The whole source file
 // @arg src_name - The name of the source file for error reporting
 // @ret - The Code object. An empty Code object is returned on error.
-Code parse(std::ifstream&, std::string&);
+Code parse(std::string_view src, const std::string &src_name);
@@ -0,0 +1,128 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "profile.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <string>
+
+
+// Prepare to profile a run of `code` from its entry point
+Profile::Profile(const Code &code)
+	: code(code), label_at(code.size(), -1), current_frame(0), current_label(-2),
+	  current(&unused), last(read_cycles()), previous(op::noop)
+{
+	for (size_t pc = 0; pc < code.size(); pc++)
+		label_at[pc] = label_before(code, pc);
+	frames.push_back(frame{0, label_called(code, code.entry_point)});
+}
+
+
+// Profile::move
+// Finds where instruction `pc` counts, after a call, a return or a new label
+void Profile::move(size_t pc)
+{
+	if (previous == op::call || previous == op::ucall) {
+		int routine = label_called(code, pc);
+		auto found = callees.find(key(current_frame, routine));
+		if (found == callees.end()) {
+			found = callees.emplace(key(current_frame, routine),
+				static_cast<uint32_t>(frames.size())).first;
+			frames.push_back(frame{current_frame, routine});
+		}
+		current_frame = found->second;
+	} else if ((previous == op::ret || previous == op::uret) && current_frame != 0) {
+		current_frame = frames[current_frame].parent;
+	}
+	current_label = label_at[pc];
+	current = &totals[key(current_frame, current_label)];
+}
+
+
+std::string_view Profile::name(int label) const
+{
+	return label < 0 ? "(no label)" : std::string_view(code.labels[label].name);
+}
+
+
+// Profile::write_collapsed
+// Writes the cycles spent in each label along each call path, one path per line, in the
+// "collapsed stacks" format taken by flame graph tools: `caller;callee;label cycles`
+void Profile::write_collapsed(std::ostream &o) const
+{
+	std::map<std::string, uint64_t> lines;
+	for (auto &t : totals) {
+		uint32_t f = static_cast<uint32_t>(t.first >> 32);
+		int label = static_cast<int>(static_cast<uint32_t>(t.first));
+
+		std::vector<uint32_t> path;
+		for (uint32_t at = f; ; at = frames[at].parent) {
+			path.push_back(at);
+			if (at == 0)
+				break;
+		}
+		std::string line;
+		for (auto i = path.rbegin(); i != path.rend(); i++) {
+			if (!line.empty())
+				line += ';';
+			line += name(frames[*i].routine);
+		}
+		if (label != frames[f].routine) {
+			line += ';';
+			line += name(label);
+		}
+		lines[line] += t.second.cycles;
+	}
+	for (auto &l : lines)
+		o << l.first << ' ' << l.second << '\n';
+	o.flush();
+}
+
+
+// Profile::write_summary
+// Writes a table of the instructions and cycles of every label that ran, by themselves (self)
+// and including the calls made from them (total), from the most total cycles to the least
+void Profile::write_summary(std::ostream &o) const
+{
+	struct row {
+		counts self;
+		counts total;
+	};
+	std::map<int, row> rows;
+	for (auto &t : totals) {
+		uint32_t f = static_cast<uint32_t>(t.first >> 32);
+		int label = static_cast<int>(static_cast<uint32_t>(t.first));
+		const counts &c = t.second;
+		rows[label].self.instrs += c.instrs;
+		rows[label].self.cycles += c.cycles;
+
+		// Recursive labels appear more than once along the path, but only count once
+		std::vector<int> seen{label};
+		for (uint32_t at = f; ; at = frames[at].parent) {
+			if (std::find(seen.begin(), seen.end(), frames[at].routine) == seen.end())
+				seen.push_back(frames[at].routine);
+			if (at == 0)
+				break;
+		}
+		for (int l : seen) {
+			rows[l].total.instrs += c.instrs;
+			rows[l].total.cycles += c.cycles;
+		}
+	}
+
+	std::vector<std::pair<int, row>> sorted(rows.begin(), rows.end());
+	std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+		return a.second.total.cycles > b.second.total.cycles;
+	});
+	o << std::left << std::setw(24) << "label" << std::right << std::setw(14) << "self instrs" <<
+		std::setw(16) << "self cycles" << std::setw(14) << "total instrs" << std::setw(16) <<
+		"total cycles" << '\n';
+	for (auto &r : sorted) {
+		o << std::left << std::setw(24) << name(r.first) << std::right <<
+			std::setw(14) << r.second.self.instrs << std::setw(16) << r.second.self.cycles <<
+			std::setw(14) << r.second.total.instrs << std::setw(16) << r.second.total.cycles << '\n';
+	}
+	o.flush();
+}
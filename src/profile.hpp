@@ -0,0 +1,98 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <cinttypes>
+#include <chrono>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "code.hpp"
+
+
+// read_cycles
+// @ret - The time stamp counter, or nanoseconds of a steady clock where there is none
+inline uint64_t read_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+// Instructions run and cycles spent, by label and by call path. Every instruction counts towards
+// the last label before it. Each `call` enters a frame named after the label it calls, and `ret`
+// goes back to the caller's frame, so a label reached along different call paths is counted apart.
+// The VM calls `step` before every instruction when running with `Options::profile`.
+class Profile {
+private:
+	struct frame {
+		uint32_t parent;
+		// Label called into, or -1
+		int routine;
+	};
+
+	struct counts {
+		uint64_t instrs = 0;
+		uint64_t cycles = 0;
+	};
+
+	const Code &code;
+	// Index in `code.labels` of the label each instruction counts towards, or -1
+	std::vector<int> label_at;
+	// Frame 0 is the entry point's
+	std::vector<frame> frames;
+	// Frame entered by calling each label from each frame
+	std::unordered_map<uint64_t, uint32_t> callees;
+	// Counts of each label within each frame
+	std::unordered_map<uint64_t, counts> totals;
+
+	// Where the instruction that ran last is counted
+	uint32_t current_frame;
+	int current_label;
+	counts *current;
+	counts unused;
+	uint64_t last;
+	op previous;
+
+	static uint64_t key(uint32_t frame, int label)
+	{
+		return uint64_t(frame) << 32 | static_cast<uint32_t>(label);
+	}
+
+	void move(size_t pc);
+	std::string_view name(int label) const;
+
+public:
+	explicit Profile(const Code &code);
+
+	Profile(const Profile&) = delete;
+	Profile &operator=(const Profile&) = delete;
+
+	// Counts instruction `pc`, of operation `o`, which is about to run. The cycles since the last
+	// call go to the instruction before it.
+	void step(size_t pc, op o)
+	{
+		uint64_t now = read_cycles();
+		current->cycles += now - last;
+		last = now;
+		if (label_at[pc] != current_label || previous == op::call || previous == op::ucall ||
+			previous == op::ret || previous == op::uret)
+			move(pc);
+		current->instrs++;
+		previous = o;
+	}
+
+	void write_collapsed(std::ostream &o) const;
+	void write_summary(std::ostream &o) const;
+};
@@ -0,0 +1,137 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "var.hpp"
+
+
+// Registers split into a bank of integers and a bank of doubles, with one bit per register telling
+// which bank holds its value. Code that only works on integers only touches the integer bank and
+// the bits, 8 bytes per register, and type checks are bit tests. Used instead of a vector of
+// `var`s in builds with DTVM_SPLIT_REGISTERS (`make REGS=split`).
+// Indexing returns a `reference`, which reads and writes like a `var`.
+class RegisterFile {
+private:
+	std::vector<int64_t> ints;
+	std::vector<double> floats;
+	// Bit `i % 64` of word `i / 64` is set when register `i` holds a double
+	std::vector<uint64_t> is_float;
+
+	bool holds_float(size_t i) const
+	{
+		return is_float[i / 64] >> (i % 64) & 1;
+	}
+
+	void set_int(size_t i, int64_t v)
+	{
+		ints[i] = v;
+		is_float[i / 64] &= ~(uint64_t(1) << (i % 64));
+	}
+
+	void set_float(size_t i, double v)
+	{
+		floats[i] = v;
+		is_float[i / 64] |= uint64_t(1) << (i % 64);
+	}
+
+	// Copies both banks and the bit, which needs no branch
+	void copy(size_t to, size_t from)
+	{
+		ints[to] = ints[from];
+		floats[to] = floats[from];
+		uint64_t bit = uint64_t(holds_float(from)) << (to % 64);
+		is_float[to / 64] = (is_float[to / 64] & ~(uint64_t(1) << (to % 64))) | bit;
+	}
+
+	void set(size_t i, const var &v)
+	{
+		if (v.get_type() == var_type::integer)
+			set_int(i, v.as_int());
+		else
+			set_float(i, v.as_float());
+	}
+
+public:
+	class reference {
+	private:
+		RegisterFile &file;
+		size_t index;
+
+	public:
+		reference(RegisterFile &file, size_t index) : file(file), index(index) {}
+
+		var_type get_type() const
+		{
+			return file.holds_float(index) ? var_type::floating : var_type::integer;
+		}
+
+		int64_t as_int() const
+		{
+			return file.ints[index];
+		}
+
+		double as_float() const
+		{
+			return file.floats[index];
+		}
+
+		operator var() const
+		{
+			return file.holds_float(index) ? var(as_float()) : var(as_int());
+		}
+
+		reference &operator=(int64_t v)
+		{
+			file.set_int(index, v);
+			return *this;
+		}
+
+		reference &operator=(double v)
+		{
+			file.set_float(index, v);
+			return *this;
+		}
+
+		reference &operator=(const var &v)
+		{
+			file.set(index, v);
+			return *this;
+		}
+
+		// Copies the value, not the reference
+		reference &operator=(const reference &r)
+		{
+			file.copy(index, r.index);
+			return *this;
+		}
+	};
+
+	RegisterFile(size_t count, const var &v)
+	{
+		assign(count, v);
+	}
+
+	reference operator[](size_t i)
+	{
+		return reference(*this, i);
+	}
+
+	size_t size() const
+	{
+		return ints.size();
+	}
+
+	// Sets all `count` registers to `v`
+	void assign(size_t count, const var &v)
+	{
+		bool f = v.get_type() == var_type::floating;
+		ints.assign(count, f ? 0 : v.as_int());
+		floats.assign(count, f ? v.as_float() : 0.0);
+		is_float.assign((count + 63) / 64, f ? ~uint64_t(0) : 0);
+	}
+};
@@ -0,0 +1,230 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#ifdef __unix__
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+#include "error.hpp"
+
+
+Sampler *Sampler::active = nullptr;
+
+
+// Prepare to sample a run of `code`, `hz` times per second
+Sampler::Sampler(const Code &code, unsigned hz)
+	: code(code), hz(hz), pc(code.entry_point), callstack(nullptr),
+	  hits(code.size(), 0), taken(0), dropped(0), stacks(max_stacks * 8), stacks_used(0)
+{
+#ifdef __unix__
+	installed = false;
+#endif
+}
+
+
+Sampler::~Sampler()
+{
+	stop();
+}
+
+
+// Sampler::start
+// Starts the timer, replacing the SIGPROF handler until `stop`
+// @ret - Whether it started. It fails if another sampler is running or there are no timers.
+bool Sampler::start()
+{
+#ifdef __unix__
+	if (active) {
+		std::cerr << Error() << "Only one sampler can run at a time" << std::endl;
+		return false;
+	}
+	active = this;
+
+	struct sigaction action = {};
+	action.sa_handler = on_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	struct itimerval timer = {};
+	timer.it_interval.tv_usec = std::max<long>(1000000 / hz, 1);
+	timer.it_value = timer.it_interval;
+	installed = sigaction(SIGPROF, &action, &previous) == 0;
+	if (!installed || setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+		std::cerr << Error() << "Could not start the sampling timer" << std::endl;
+		stop();
+		return false;
+	}
+	return true;
+#else
+	std::cerr << Error() << "Sampling needs a Unix system" << std::endl;
+	return false;
+#endif
+}
+
+
+// Sampler::stop
+// Stops the timer, if this sampler started it, and puts back the SIGPROF handler it replaced
+void Sampler::stop()
+{
+#ifdef __unix__
+	if (active != this)
+		return;
+	struct itimerval timer = {};
+	setitimer(ITIMER_PROF, &timer, nullptr);
+	if (installed) {
+		// Blocked while the handlers are switched. Ignoring it first discards a tick still
+		// pending, which the previous handler, or the default action of ending the process,
+		// would get otherwise.
+		sigset_t prof, mask;
+		sigemptyset(&prof);
+		sigaddset(&prof, SIGPROF);
+		pthread_sigmask(SIG_BLOCK, &prof, &mask);
+		signal(SIGPROF, SIG_IGN);
+		sigaction(SIGPROF, &previous, nullptr);
+		pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+		installed = false;
+	}
+	active = nullptr;
+#endif
+}
+
+
+// Sampler::on_signal
+// Runs on SIGPROF, in between any two instructions, so it only reads what `at` published and
+// writes to memory nothing else touches
+void Sampler::on_signal(int)
+{
+	int saved = errno;
+	if (active)
+		active->sample();
+	errno = saved;
+}
+
+
+void Sampler::sample()
+{
+	size_t at = static_cast<size_t>(pc);
+	taken++;
+	if (at < hits.size())
+		hits[at]++;
+
+	size_t depth = callstack ? callstack->size() : 0;
+	size_t kept = std::min(depth, max_depth);
+	if (stacks_used + kept + 1 > stacks.size()) {
+		dropped++;
+		return;
+	}
+	stacks[stacks_used++] = depth;
+	for (size_t i = 0; i < kept; i++)
+		stacks[stacks_used++] = callstack->begin()[depth - 1 - i];
+}
+
+
+// Sampler::routine_returning_to
+// @arg ret - A return address on the callstack
+// @ret - Index in `code.labels` of the routine called by the instruction before `ret`, or -1
+int Sampler::routine_returning_to(size_t ret) const
+{
+	if (ret == 0 || ret > code.size())
+		return -1;
+	const instr &call = code[static_cast<int>(ret - 1)];
+	if (call.code != op::call && call.code != op::ucall)
+		return label_before(code, ret - 1);
+	return label_called(code, static_cast<size_t>(call.imm));
+}
+
+
+// Sampler::report
+// Writes the instructions with the most samples, with their source lines and labels, and then
+// the routines with the most samples by themselves (self) and along with what they call (total)
+void Sampler::report(std::ostream &o) const
+{
+	auto name = [this](int label) {
+		return label < 0 ? std::string("(no label)") : code.labels[label].name;
+	};
+	auto percent = [](uint64_t n, uint64_t of) {
+		return of ? 100.0 * static_cast<double>(n) / static_cast<double>(of) : 0.0;
+	};
+	auto flags = o.flags();
+	o << std::fixed << std::setprecision(1);
+
+	o << "Samples: " << taken << " at " << hz << " Hz";
+	if (dropped)
+		o << ", " << dropped << " of them without calls";
+	o << '\n' << '\n';
+
+	std::vector<size_t> hot;
+	for (size_t i = 0; i < hits.size(); i++) {
+		if (hits[i])
+			hot.push_back(i);
+	}
+	std::stable_sort(hot.begin(), hot.end(), [this](size_t a, size_t b) {
+		return hits[a] > hits[b];
+	});
+	if (hot.size() > 20)
+		hot.resize(20);
+	o << std::setw(8) << "pc" << std::setw(10) << "samples" << std::setw(8) << "%" <<
+		std::setw(8) << "line" << "  " << std::left << std::setw(24) << "label" << "instruction" <<
+		std::right << '\n';
+	for (size_t i : hot) {
+		o << std::setw(8) << i << std::setw(10) << hits[i] << std::setw(8) <<
+			percent(hits[i], taken) << std::setw(8);
+		if (i < code.lines.size() && code.lines[i] > 0)
+			o << code.lines[i];
+		else
+			o << '-';
+		o << "  " << std::left << std::setw(24) << name(label_before(code, i)) << std::right;
+		display_instr(o, code[static_cast<int>(i)], code);
+		o << '\n';
+	}
+	o << '\n';
+
+	// Recursive routines appear more than once in a sample, but only count once
+	struct row {
+		uint64_t self = 0;
+		uint64_t total = 0;
+	};
+	std::map<int, row> rows;
+	const int entry = label_called(code, static_cast<size_t>(code.entry_point));
+	std::vector<int> seen;
+	for (size_t at = 0; at < stacks_used; ) {
+		size_t depth = stacks[at++];
+		size_t kept = std::min(depth, max_depth);
+		seen.clear();
+		for (size_t i = 0; i < kept; i++)
+			seen.push_back(routine_returning_to(stacks[at + i]));
+		// The entry point's routine is at the bottom, unless there were too many calls to keep
+		if (depth <= max_depth)
+			seen.push_back(entry);
+		at += kept;
+
+		rows[seen.front()].self++;
+		std::sort(seen.begin(), seen.end());
+		seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+		for (int r : seen)
+			rows[r].total++;
+	}
+	const uint64_t with_calls = taken - dropped;
+	std::vector<std::pair<int, row>> sorted(rows.begin(), rows.end());
+	std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+		return a.second.total > b.second.total;
+	});
+	o << std::left << std::setw(24) << "routine" << std::right << std::setw(10) << "self" <<
+		std::setw(8) << "%" << std::setw(10) << "total" << std::setw(8) << "%" << '\n';
+	for (auto &r : sorted) {
+		o << std::left << std::setw(24) << name(r.first) << std::right <<
+			std::setw(10) << r.second.self << std::setw(8) << percent(r.second.self, with_calls) <<
+			std::setw(10) << r.second.total << std::setw(8) << percent(r.second.total, with_calls) <<
+			'\n';
+	}
+	o.flags(flags);
+	o.flush();
+}
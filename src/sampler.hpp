@@ -0,0 +1,82 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <csignal>
+#include <cinttypes>
+#include <ostream>
+#include <vector>
+
+#ifdef __unix__
+#include <signal.h>
+#endif
+
+#include "code.hpp"
+#include "stack.hpp"
+
+
+// Samples where a program is, `hz` times per second of CPU time, from a SIGPROF timer. The VM
+// publishes the instruction about to run with `at` when running with `Options::sampler`, which
+// costs a store per instruction instead of the work `Profile` does. At each tick the signal
+// handler counts the instruction and copies the innermost return addresses of the callstack into a
+// buffer allocated up front, so it never locks or allocates. Once stopped, `report` maps the
+// samples back to source lines and labels.
+// Only one sampler runs at a time. Timers are only there on Unix systems.
+class Sampler {
+private:
+	// Calls kept per sample, innermost first
+	static constexpr size_t max_depth = 64;
+	// Samples whose calls fit in the buffer, if they average 7 calls each
+	static constexpr size_t max_stacks = 1 << 16;
+
+	const Code &code;
+	unsigned hz;
+	volatile std::sig_atomic_t pc;
+	const FixedStack<size_t> *callstack;
+
+	// Samples taken at each instruction
+	std::vector<uint64_t> hits;
+	// Samples since `start`, and those whose calls didn't fit in `stacks`
+	uint64_t taken;
+	uint64_t dropped;
+	// Each sample as its number of calls followed by their return addresses, innermost first
+	std::vector<size_t> stacks;
+	size_t stacks_used;
+
+#ifdef __unix__
+	// The SIGPROF handler before `start`, put back by `stop`
+	struct sigaction previous;
+	bool installed;
+#endif
+
+	static Sampler *active;
+	static void on_signal(int);
+
+	void sample();
+	int routine_returning_to(size_t ret) const;
+
+public:
+	Sampler(const Code &code, unsigned hz);
+	~Sampler();
+
+	Sampler(const Sampler&) = delete;
+	Sampler &operator=(const Sampler&) = delete;
+
+	// Instruction `pc` is about to run. A volatile store, since atomics keep the compiler from
+	// holding the interpreter's state in registers, so the calls sampled may lag an instruction.
+	void at(size_t pc)
+	{
+		this->pc = static_cast<std::sig_atomic_t>(pc);
+	}
+
+	// Reads the calls from `callstack` at every sample from now on
+	void watch(const FixedStack<size_t> *callstack)
+	{
+		this->callstack = callstack;
+	}
+
+	bool start();
+	void stop();
+	void report(std::ostream &o) const;
+};
@@ -0,0 +1,78 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+
+// A stack of at most `capacity` values, allocated once and never grown. Nothing is checked here:
+// callers check `full` before pushing and `empty` before popping, unless the depth analysis
+// proved there is no need to. Memory is only touched as the stack grows into it.
+template <typename T>
+class FixedStack {
+	static_assert(std::is_trivially_copyable<T>::value, "values are copied in and out as bytes");
+
+private:
+	T *base;
+	T *next;
+	T *limit;
+
+public:
+	explicit FixedStack(size_t capacity)
+		: base(std::allocator<T>().allocate(capacity)), next(base), limit(base + capacity)
+	{
+	}
+
+	~FixedStack()
+	{
+		std::allocator<T>().deallocate(base, capacity());
+	}
+
+	FixedStack(const FixedStack&) = delete;
+	FixedStack &operator=(const FixedStack&) = delete;
+
+	void push(const T &v)
+	{
+		new (next++) T(v);
+	}
+
+	T pop()
+	{
+		return *--next;
+	}
+
+	bool empty() const
+	{
+		return next == base;
+	}
+
+	bool full() const
+	{
+		return next == limit;
+	}
+
+	size_t size() const
+	{
+		return next - base;
+	}
+
+	size_t capacity() const
+	{
+		return limit - base;
+	}
+
+	// The bottom of the stack; the values pushed are from here to `size()` past it
+	const T *begin() const
+	{
+		return base;
+	}
+
+	void clear()
+	{
+		next = base;
+	}
+};
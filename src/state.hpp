@@ -0,0 +1,47 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <cinttypes>
+#include <vector>
+
+#include "input.hpp"
+#include "output.hpp"
+#include "registers.hpp"
+#include "stack.hpp"
+#include "var.hpp"
+
+
+enum state_flag {
+	VM_FLAG_GT = 0b0100,
+	VM_FLAG_EQ = 0b0010,
+	VM_FLAG_LT = 0b0001,
+};
+
+
+// Everything a running program can change. The JIT works on the same state as the interpreter, so
+// execution can move from one to the other.
+struct vm_state {
+#ifdef DTVM_SPLIT_REGISTERS
+	RegisterFile reg;
+#else
+	std::vector<var> reg;
+#endif
+	FixedStack<var> stack;
+	FixedStack<size_t> callstack;
+	uint8_t flags = 0;
+	// Whether the last input instruction failed, as read by `ipf`
+	int8_t stdin_state = 0;
+	// Set when native code stops the program on an error
+	bool failed = false;
+	Input in;
+	Output out;
+
+	vm_state(size_t num_regs, size_t stack_size, size_t callstack_size, flush_policy policy,
+	         InputSource *input = nullptr, OutputSink *output = nullptr)
+		: reg(num_regs, var(0)), stack(stack_size), callstack(callstack_size), in(input),
+		  out(policy, output)
+	{
+	}
+};
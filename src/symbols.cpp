@@ -0,0 +1,80 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "symbols.hpp"
+
+
+// FNV-1a, continued from `h` so a concatenation can be hashed in parts
+static uint64_t hash(std::string_view s, uint64_t h = 14695981039346656037ull)
+{
+	for (char c : s) {
+		h ^= static_cast<unsigned char>(c);
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+
+// Empty table
+SymbolTable::SymbolTable()
+	: starts(1, 0), slots(64, 0)
+{
+}
+
+
+// Double the number of slots and reinsert every name
+void SymbolTable::grow()
+{
+	slots.assign(slots.size() * 2, 0);
+	size_t mask = slots.size() - 1;
+	for (uint32_t id = 0; id < size(); id++) {
+		size_t i = hash(name(id)) & mask;
+		while (slots[i] != 0)
+			i = (i + 1) & mask;
+		slots[i] = id + 1;
+	}
+}
+
+
+uint32_t SymbolTable::intern(std::string_view name)
+{
+	return intern(std::string_view(), name);
+}
+
+
+uint32_t SymbolTable::intern(std::string_view prefix, std::string_view name)
+{
+	size_t length = prefix.size() + name.size();
+	size_t mask = slots.size() - 1;
+	size_t i = hash(name, hash(prefix)) & mask;
+	for (; slots[i] != 0; i = (i + 1) & mask) {
+		auto candidate = this->name(slots[i] - 1);
+		if (candidate.size() == length && candidate.substr(0, prefix.size()) == prefix &&
+			candidate.substr(prefix.size()) == name)
+			return slots[i] - 1;
+	}
+
+	uint32_t id = static_cast<uint32_t>(size());
+	names.append(prefix);
+	names.append(name);
+	starts.push_back(static_cast<uint32_t>(names.size()));
+	slots[i] = id + 1;
+	// Keep at most half of the slots used, so probe sequences stay short
+	if (size() * 2 > slots.size())
+		grow();
+	return id;
+}
+
+
+// Name interned with ID `id`
+std::string_view SymbolTable::name(uint32_t id) const
+{
+	return std::string_view(names).substr(starts[id], starts[id + 1] - starts[id]);
+}
+
+
+// Number of names interned
+size_t SymbolTable::size() const
+{
+	return starts.size() - 1;
+}
@@ -0,0 +1,34 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <cinttypes>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Interns names into dense integer IDs, starting at 0. Lookups go through an open addressing
+// hash table with linear probing, and every name is stored once in a single buffer.
+class SymbolTable {
+private:
+	// Characters of every name, back to back
+	std::string names;
+	// Start of each name in `names`, indexed by ID, plus the end of the last one
+	std::vector<uint32_t> starts;
+	// ID + 1 of the name in each slot, or 0 for empty slots. The size is a power of two.
+	std::vector<uint32_t> slots;
+
+	void grow();
+
+public:
+	SymbolTable();
+
+	// IDs of `name`, and of the concatenation of `prefix` and `name`, interning them if needed
+	uint32_t intern(std::string_view name);
+	uint32_t intern(std::string_view prefix, std::string_view name);
+
+	std::string_view name(uint32_t id) const;
+	size_t size() const;
+};
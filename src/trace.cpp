@@ -0,0 +1,222 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#include "trace.hpp"
+
+#include <iostream>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "error.hpp"
+#include "file.hpp"
+
+
+static const char trace_magic[4] = {'D', 'T', 'V', 'T'};
+static const uint32_t trace_version = 1;
+
+#ifdef __unix__
+// Signals that end the process, after which the trace is written out
+static const int fatal_signals[] = {
+	SIGINT, SIGTERM, SIGHUP, SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT,
+};
+#endif
+
+
+Trace *Trace::active = nullptr;
+
+
+// Prepare to trace the last `capacity` steps, rounded up to a power of two, of a run of `code`
+Trace::Trace(const Code &code, size_t capacity)
+	: code(code), written(code.size()), mask(0), steps(0), last(nullptr), pending(-1), fd(-1)
+{
+#ifdef __unix__
+	static_assert(sizeof(fatal_signals) / sizeof(*fatal_signals) == num_signals,
+	              "there must be a previous handler for each fatal signal");
+#endif
+	for (size_t pc = 0; pc < code.size(); pc++)
+		written[pc] = written_reg(code[static_cast<int>(pc)]);
+	size_t size = 1;
+	while (size < capacity)
+		size *= 2;
+	records.resize(size);
+	mask = size - 1;
+}
+
+
+Trace::~Trace()
+{
+#ifdef __unix__
+	if (active == this) {
+		for (size_t i = 0; i < num_signals; i++)
+			sigaction(fatal_signals[i], &previous[i], nullptr);
+		active = nullptr;
+	}
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+
+// Trace::open
+// Creates the file the trace is written to, and writes it there on fatal signals from now on,
+// until the trace is destroyed, which puts back the handlers it replaced
+// @arg path - Path of the file
+// @ret - Whether the file could be created. Only one trace can be open at a time.
+bool Trace::open(const std::string &path)
+{
+#ifdef __unix__
+	if (active) {
+		std::cerr << Error() << "Only one trace can be open at a time" << std::endl;
+		return false;
+	}
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		std::cerr << Error() << "Could not write file '" << path << "'" << std::endl;
+		return false;
+	}
+	active = this;
+	struct sigaction action = {};
+	action.sa_handler = on_signal;
+	sigemptyset(&action.sa_mask);
+	for (size_t i = 0; i < num_signals; i++)
+		sigaction(fatal_signals[i], &action, &previous[i]);
+	return true;
+#else
+	std::cerr << Error() << "Tracing needs a Unix system" << std::endl;
+	return false;
+#endif
+}
+
+
+// Trace::on_signal
+// Writes the trace out, then raises the signal again for the handler it replaced, which ends the
+// process unless the program embedding the VM handles it
+void Trace::on_signal(int sig)
+{
+#ifdef __unix__
+	if (active) {
+		active->write();
+		for (size_t i = 0; i < num_signals; i++) {
+			if (fatal_signals[i] == sig)
+				sigaction(sig, &active->previous[i], nullptr);
+		}
+	} else {
+		signal(sig, SIG_DFL);
+	}
+	raise(sig);
+#endif
+}
+
+
+bool Trace::write_all(const void *data, size_t size)
+{
+#ifdef __unix__
+	const char *at = static_cast<const char*>(data);
+	while (size > 0) {
+		ssize_t n = ::write(fd, at, size);
+		if (n < 0)
+			return false;
+		at += n;
+		size -= n;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+// Trace::write
+// Writes the header and the records kept, from the oldest to the newest, over anything written
+// before. Only calls what is safe to call from a signal handler.
+// @ret - Whether everything was written
+bool Trace::write()
+{
+#ifdef __unix__
+	if (fd < 0 || lseek(fd, 0, SEEK_SET) < 0 || ftruncate(fd, 0) != 0)
+		return false;
+	header h;
+	std::memcpy(h.magic, trace_magic, sizeof(h.magic));
+	h.version = trace_version;
+	h.num_instrs = static_cast<uint32_t>(code.size());
+	h.unused = 0;
+	h.steps = steps;
+	h.count = steps < records.size() ? steps : records.size();
+	if (!write_all(&h, sizeof(h)))
+		return false;
+	// Once the buffer wrapped around, the oldest record is the next to be overwritten
+	size_t oldest = steps < records.size() ? 0 : steps & mask;
+	return write_all(records.data() + oldest, (h.count - oldest) * sizeof(trace_record)) &&
+		write_all(records.data(), oldest * sizeof(trace_record));
+#else
+	return false;
+#endif
+}
+
+
+// show_trace
+// @exported
+// Prints the steps of the trace at `path`, one per line, with the register each wrote
+// @arg path - Path of a file written by `Trace`
+// @arg code - The code the trace was recorded from, read with the same options
+// @arg o    - Where to print it
+// @ret - Whether the file was a trace of `code`
+bool show_trace(const std::string &path, const Code &code, std::ostream &o)
+{
+	FileView file(path);
+	if (!file.is_open()) {
+		std::cerr << Error() << "Could not open file '" << path << "'" << std::endl;
+		return false;
+	}
+	Trace::header h;
+	if (file.size < sizeof(h) || std::memcmp(file.data, trace_magic, sizeof(trace_magic)) != 0) {
+		std::cerr << Error() << "'" << path << "' is not a trace" << std::endl;
+		return false;
+	}
+	std::memcpy(&h, file.data, sizeof(h));
+	if (h.version != trace_version || file.size != sizeof(h) + h.count * sizeof(trace_record)) {
+		std::cerr << Error() << "'" << path << "' is not a trace of this version" << std::endl;
+		return false;
+	}
+	if (h.num_instrs != code.size()) {
+		std::cerr << Error() << "The trace at '" << path << "' was recorded from other code" <<
+			std::endl;
+		return false;
+	}
+
+	o << "Last " << h.count << " of " << h.steps << " steps\n";
+	for (uint64_t i = 0; i < h.count; i++) {
+		trace_record r;
+		std::memcpy(&r, file.data + sizeof(h) + i * sizeof(r), sizeof(r));
+		if (r.pc >= code.size() || static_cast<size_t>(r.code) >= num_ops) {
+			std::cerr << Error() << "The trace at '" << path << "' was recorded from other code" <<
+				std::endl;
+			return false;
+		}
+		instr ins = code[static_cast<int>(r.pc)];
+		ins.code = r.code;
+		o << h.steps - h.count + i << '\t' << r.pc << ":\t";
+		display_instr(o, ins, code);
+		// A superinstruction ran the instructions after it too, which are still there to show
+		for (size_t k = 1; k < fused_length(r.code) && r.pc + k < code.size(); k++) {
+			o << " ; ";
+			display_instr(o, code[static_cast<int>(r.pc + k)], code);
+		}
+		if (r.type == TRACE_INT) {
+			o << "\t; r" << r.reg << " = " << static_cast<int64_t>(r.value);
+		} else if (r.type == TRACE_FLOAT) {
+			double f;
+			std::memcpy(&f, &r.value, sizeof(f));
+			o << "\t; r" << r.reg << " = " << f;
+		} else if (r.type == TRACE_FAILED) {
+			o << "\t; failed";
+		}
+		o << '\n';
+	}
+	o.flush();
+	return true;
+}
@@ -0,0 +1,138 @@
+// Copyright (c) 2017 Victhor S. Sartorio. All rights reserved.
+// Licensed under the MIT License. See LICENSE file in the project root.
+
+#pragma once
+
+#include <cinttypes>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef __unix__
+#include <signal.h>
+#endif
+
+#include "code.hpp"
+#include "state.hpp"
+
+
+// One step of a trace: the instruction run, as it was when it ran, and the register it wrote
+struct trace_record {
+	uint32_t pc;
+	op code;
+	// One of `trace_value`
+	uint8_t type;
+	uint16_t reg;
+	// The integer, or the bits of the floating point, written to `reg`
+	uint64_t value;
+};
+static_assert(sizeof(trace_record) == 16, "trace records should be packed into 16 bytes");
+
+enum trace_value : uint8_t {
+	TRACE_INT,
+	TRACE_FLOAT,
+	// The instruction writes no register
+	TRACE_NONE,
+	// The instruction didn't finish running
+	TRACE_PENDING,
+	// The instruction failed, so the program ended there
+	TRACE_FAILED,
+};
+
+
+// The last steps a program ran, kept in a ring buffer allocated up front, which is written to a
+// file when the program halts or fails, or when the process gets a fatal signal. Each step is
+// recorded before it runs, and the value it wrote is filled in before the next one. `show_trace`
+// reads the file back with the same code.
+// Only one trace is open at a time. Signals are only caught on Unix systems, and after the trace
+// is written, they go on to the handlers they had before.
+class Trace {
+private:
+	const Code &code;
+	// The register each instruction writes, or -1
+	std::vector<int32_t> written;
+	std::vector<trace_record> records;
+	// `records` has a power of two size
+	uint64_t mask;
+	// Steps recorded since the start, including the ones overwritten since
+	uint64_t steps;
+	trace_record *last;
+	// Register `last` writes, or -1 once filled in
+	int32_t pending;
+	int fd;
+
+	// Number of fatal signals the trace is written out on
+	static constexpr size_t num_signals = 8;
+#ifdef __unix__
+	// Their handlers before `open`, put back when the trace is destroyed
+	struct sigaction previous[num_signals];
+#endif
+
+	static Trace *active;
+	static void on_signal(int sig);
+
+	bool write_all(const void *data, size_t size);
+
+public:
+	// The file starts with this header, followed by the records from the oldest to the newest
+	struct header {
+		char magic[4];
+		uint32_t version;
+		// Size of the code the trace was recorded from
+		uint32_t num_instrs;
+		uint32_t unused;
+		uint64_t steps;
+		uint64_t count;
+	};
+
+	Trace(const Code &code, size_t capacity);
+	~Trace();
+
+	Trace(const Trace&) = delete;
+	Trace &operator=(const Trace&) = delete;
+
+	// Records instruction `pc` of `ins`, which is about to run, after filling in the register
+	// the last one wrote
+	void step(const instr *ins, size_t pc, vm_state &state)
+	{
+		finish(state);
+		trace_record &r = records[steps++ & mask];
+		pending = written[pc];
+		r.pc = static_cast<uint32_t>(pc);
+		r.code = ins[pc].code;
+		r.type = pending < 0 ? TRACE_NONE : TRACE_PENDING;
+		r.reg = static_cast<uint16_t>(pending);
+		last = &r;
+	}
+
+	// Fills in the register the last instruction wrote, once it ran
+	void finish(vm_state &state)
+	{
+		if (pending < 0)
+			return;
+		const var v = state.reg[pending];
+		pending = -1;
+		if (v.get_type() == var_type::integer) {
+			last->type = TRACE_INT;
+			last->value = static_cast<uint64_t>(v.as_int());
+		} else {
+			double f = v.as_float();
+			last->type = TRACE_FLOAT;
+			std::memcpy(&last->value, &f, sizeof(f));
+		}
+	}
+
+	// Marks the last instruction as the one that failed, instead of filling in what it wrote
+	void fail()
+	{
+		pending = -1;
+		if (last)
+			last->type = TRACE_FAILED;
+	}
+
+	bool open(const std::string &path);
+	bool write();
+};
+
+bool show_trace(const std::string &path, const Code &code, std::ostream &o);
@@ -5,17 +5,96 @@
 
 #include <ostream>
 #include <cinttypes>
-
-#include "op.hpp"
+#include <cstddef>
+#include <cstring>
 
 
 enum class var_type {
 	integer,
 	floating,
-	operation,
 };
 
 
+// Values
+// A value is either a 64-bit integer or a double. By default it is stored as its type next to a
+// union of both, 16 bytes in all. Builds with DTVM_NAN_BOXING (`make VALUES=nan-boxed`) store it
+// in a single 8-byte word instead:
+// - doubles are stored as they are, except that every NaN becomes the same positive quiet NaN
+// - integers are stored as the payload of the negative quiet NaNs, which leaves them 51 bits
+// So integers range from `var::min_int` to `var::max_int` there, and results outside that range
+// wrap around within it. Native code is generated for the 16-byte layout only, so NaN-boxed builds
+// always interpret.
+// The accessors are defined here, since the interpreter uses them for every instruction.
+#ifdef DTVM_NAN_BOXING
+
+class var {
+private:
+	uint64_t bits;
+
+	// Integers have the sign, every exponent bit and the quiet bit set
+	static constexpr unsigned payload_bits = 51;
+	static constexpr uint64_t int_tag = 0x1FFF;
+	static constexpr uint64_t payload_mask = (uint64_t(1) << payload_bits) - 1;
+	static constexpr uint64_t canonical_nan = 0x7FF8000000000000;
+
+	static uint64_t box(int64_t i)
+	{
+		return int_tag << payload_bits | (static_cast<uint64_t>(i) & payload_mask);
+	}
+
+	static uint64_t box(double f)
+	{
+		if (f != f)
+			return canonical_nan;
+		uint64_t b;
+		std::memcpy(&b, &f, sizeof(b));
+		return b;
+	}
+
+public:
+	static constexpr int64_t min_int = -(int64_t(1) << (payload_bits - 1));
+	static constexpr int64_t max_int = (int64_t(1) << (payload_bits - 1)) - 1;
+
+	var() : bits(box(int64_t(0))) {}
+	var(int i) : bits(box(int64_t(i))) {}
+	var(int64_t i) : bits(box(i)) {}
+	var(double f) : bits(box(f)) {}
+
+	var_type get_type() const
+	{
+		return bits >> payload_bits == int_tag ? var_type::integer : var_type::floating;
+	}
+
+	var operator=(const int64_t &rhs)
+	{
+		bits = box(rhs);
+		return *this;
+	}
+
+	var operator=(const double &rhs)
+	{
+		bits = box(rhs);
+		return *this;
+	}
+
+	int64_t as_int() const
+	{
+		// Sign-extends the payload
+		return static_cast<int64_t>(bits << (64 - payload_bits)) >> (64 - payload_bits);
+	}
+
+	double as_float() const
+	{
+		double f;
+		std::memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+};
+
+static_assert(sizeof(var) == 8, "NaN-boxed values take a single word");
+
+#else
+
 class var {
 private:
 	var_type type;
@@ -23,27 +102,51 @@ private:
 	union {
 		int64_t i;
 		double f;
-		op o;
 	} value;
 
 public:
-	var();
-	var(int i);
-	var(int64_t i);
-	var(double f);
-	var(const op o);
+	var() : type(var_type::integer) { value.i = 0; }
+	var(int i) : type(var_type::integer) { value.i = i; }
+	var(int64_t i) : type(var_type::integer) { value.i = i; }
+	var(double f) : type(var_type::floating) { value.f = f; }
+
+	// Return the type it currently holds
+	var_type get_type() const
+	{
+		return type;
+	}
 
-	var_type get_type() const;
+	var operator=(const int64_t &rhs)
+	{
+		type = var_type::integer;
+		value.i = rhs;
+		return *this;
+	}
 
-	var operator=(const int64_t &rhs);
-	var operator=(const double &rhs);
-	var operator=(const op &rhs);
+	var operator=(const double &rhs)
+	{
+		type = var_type::floating;
+		value.f = rhs;
+		return *this;
+	}
 
-	int64_t as_int() const;
-	double as_float() const;
-	op as_op() const;
+	int64_t as_int() const
+	{
+		return value.i;
+	}
+
+	double as_float() const
+	{
+		return value.f;
+	}
+
+	// Byte offsets of the type and of the value, for machine code generated at runtime
+	static const size_t type_offset;
+	static const size_t value_offset;
 };
 
+#endif
+
 
 // Prints the proper value based on the type
 std::ostream &operator<<(std::ostream &os, var const &v);
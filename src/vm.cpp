@@ -3,337 +3,1092 @@
 
 #include "vm.hpp"
 
+#include <algorithm>
 #include <iostream>
-#include <stack>
-#include <limits>
+#include <memory>
 
 #include "args.hpp"
 #include "error.hpp"
+#include "jit.hpp"
+#include "state.hpp"
 
 
-enum state_flag {
-    VM_FLAG_GT = 0b0100,
-    VM_FLAG_EQ = 0b0010,
-    VM_FLAG_LT = 0b0001,
+// Dispatch
+// When the compiler supports taking the address of labels (GCC and Clang), every handler jumps
+// directly to the handler of the next instruction through `dispatch_table`, so each handler gets
+// its own indirect branch and there is no loop bookkeeping between instructions. Otherwise the
+// handlers are the cases of a plain `switch` inside an endless loop.
+#if defined(__GNUC__) && !defined(DTVM_NO_COMPUTED_GOTO)
+#define DTVM_COMPUTED_GOTO
+#endif
+
+#define VM_LABEL(o) target_##o
+
+#ifdef DTVM_COMPUTED_GOTO
+#define VM_TARGET(o) VM_LABEL(o)
+#define VM_DISPATCH() do { \
+        if (!policy.step(ins, code, pc, state)) \
+            goto pause; \
+        goto *dispatch_table[static_cast<size_t>(ins[pc].code)]; \
+    } while (false)
+#else
+#define VM_TARGET(o) case op::o: VM_LABEL(o)
+#define VM_DISPATCH() continue
+// Only the labels used by VM_REWRITE and the checked stack instructions are jumped to
+#pragma GCC diagnostic ignored "-Wunused-label"
+#endif
+
+// Quickening
+// Generic arithmetic and comparison instructions check the types of their operands, rewrite
+// themselves into the matching typed variant and jump straight into it. Typed variants only
+// check that the types are still the expected ones, and rewrite themselves back into the generic
+// instruction otherwise.
+#define VM_REWRITE(o) do { \
+        ins[pc].code = op::o; \
+        goto VM_LABEL(o); \
+    } while (false)
+
+// Tiering
+// Every instruction jumped to backwards (loop heads) or called (function entries) counts how many
+// times it was reached that way. Once one of them gets hot, the whole program is translated to
+// native code, and execution continues there from that instruction, in the middle of the loop or
+// call, with the same state.
+constexpr uint32_t tier_up_threshold = 1000;
+
+#define VM_JUMP(target) do { \
+        size_t to = (target); \
+        if (tiering && to <= pc && ++hits[to] == tier_up_threshold) { \
+            pc = to; \
+            goto tier_up; \
+        } \
+        pc = to; \
+    } while (false)
+
+
+// debug_step
+// Prints the instruction about to be executed when running in debug mode.
+// @arg ins  - The instructions being executed
+// @arg code - The code they come from
+// @arg pc   - Index of the instruction about to be executed
+// @arg out  - Output of the program, written out first so both stay in order
+static void debug_step(const instr *ins, const Code &code, size_t pc, Output &out)
+{
+    out.flush();
+    if (pc >= 1 && (ins[pc-1].code == op::ods || ins[pc-1].code == op::ofv))
+        std::cout << '\n';
+    if (dtvm_args::no_ansi_color_codes) {
+        std::cout << "DEBUG:\t";
+        display_instr(std::cout, ins[pc], code);
+        std::cout << std::endl;
+    } else {
+        std::cout << "\033[1;30;43m" << pc << ":\t";
+        display_instr(std::cout, ins[pc], code);
+        std::cout << "\033[0m" << std::endl;
+    }
+}
+
+
+// compare
+// Computes the flags resulting from comparing two values of the same type
+template <typename T>
+static inline uint8_t compare(T v1, T v2)
+{
+    if (v1 < v2)
+        return VM_FLAG_LT;
+    else if (v1 == v2)
+        return VM_FLAG_EQ;
+    return VM_FLAG_GT;
+}
+
+
+// Policies
+// The interpreter loop is instantiated once for each policy, whose `step` runs before every
+// instruction and stops the loop by returning false. The release policy does nothing there, so
+// its loop has no instrumentation at all. The instantiation is picked once, before running.
+struct release_policy {
+    static constexpr bool tiering = true;
+
+    bool step(const instr *, const Code &, size_t, vm_state &)
+    {
+        return true;
+    }
+};
+
+struct debug_policy {
+    // Debug mode shows every instruction as it runs, so nothing moves to native code
+    static constexpr bool tiering = false;
+
+    bool step(const instr *ins, const Code &code, size_t pc, vm_state &state)
+    {
+        debug_step(ins, code, pc, state.out);
+        return true;
+    }
+};
+
+// Stops after running `left` instructions
+template <typename Base>
+struct stepping_policy : Base {
+    // Native code can't stop halfway
+    static constexpr bool tiering = false;
+    uint64_t left = 0;
+
+    bool step(const instr *ins, const Code &code, size_t pc, vm_state &state)
+    {
+        if (left == 0)
+            return false;
+        left--;
+        return Base::step(ins, code, pc, state);
+    }
+};
+
+// Counts every instruction in a profile, by label and call path
+template <typename Base>
+struct profiling_policy : Base {
+    // Native code can't be profiled
+    static constexpr bool tiering = false;
+    Profile *profile = nullptr;
+
+    bool step(const instr *ins, const Code &code, size_t pc, vm_state &state)
+    {
+        profile->step(pc, ins[pc].code);
+        return Base::step(ins, code, pc, state);
+    }
+};
+
+// Publishes every instruction to a sampler, which a timer signal reads
+template <typename Base>
+struct sampling_policy : Base {
+    // Native code doesn't publish where it is
+    static constexpr bool tiering = false;
+    Sampler *sampler = nullptr;
+
+    bool step(const instr *ins, const Code &code, size_t pc, vm_state &state)
+    {
+        sampler->at(pc);
+        return Base::step(ins, code, pc, state);
+    }
 };
 
+// Records every instruction in a trace
+template <typename Base>
+struct tracing_policy : Base {
+    // Native code doesn't record its steps
+    static constexpr bool tiering = false;
+    Trace *trace = nullptr;
 
-void execute(Code code)
+    bool step(const instr *ins, const Code &code, size_t pc, vm_state &state)
+    {
+        trace->step(ins, pc, state);
+        return Base::step(ins, code, pc, state);
+    }
+};
+
+// Counts the instructions run
+template <typename Base>
+struct counting_policy : Base {
+    // Native code doesn't count instructions
+    static constexpr bool tiering = false;
+    uint64_t count = 0;
+
+    bool step(const instr *ins, const Code &code, size_t pc, vm_state &state)
+    {
+        count++;
+        return Base::step(ins, code, pc, state);
+    }
+};
+
+
+namespace dtvm {
+
+// Prepare to run `program` from its entry point
+// @arg program - The code to run, which is never written to
+// @arg options - How to run it
+VM::VM(std::shared_ptr<const Code> program, const Options &options)
+    : program(std::move(program)), options(options),
+      state(std::max<size_t>(options.num_regs, num_used_regs(*this->program)),
+            std::max(options.stack_size, this->program->max_stack),
+            std::max(options.stack_size, this->program->max_calls), options.flush,
+            options.input, options.output),
+      finished(false), result(status::paused), executed(0), tiering(options.tiering)
+{
+    const Code &code = *this->program;
+    instrs.assign(code.raw(), code.raw() + code.size());
+    pc = code.entry_point;
+}
+
+
+// VM::reset
+// Clears registers, stacks and flags, and moves back to the entry point. Rewritten instructions
+// and native code are kept, so running again doesn't start cold.
+void VM::reset()
+{
+    state.reg.assign(state.reg.size(), var(0));
+    state.stack.clear();
+    state.callstack.clear();
+    state.flags = 0;
+    state.stdin_state = 0;
+    state.failed = false;
+    pc = program->entry_point;
+    finished = false;
+    result = status::paused;
+}
+
+
+// VM::reset
+// Like `reset()`, and then reads input from `input` and writes output to `output` from now on,
+// or stdin and stdout if they are null. Output still buffered goes to the previous sink first.
+void VM::reset(InputSource *input, OutputSink *output)
 {
-    std::stack<var> stack;
-    std::stack<size_t> callstack;
-    std::vector<var> reg(dtvm_args::num_regs, var(0));
-    uint8_t flags = 0;
+    reset();
+    state.in.reset(input);
+    state.out.reset(output);
+    options.input = input;
+    options.output = output;
+}
+
+
+// VM::run
+// Runs the program until it halts or fails
+// @ret - `halted` or `failed`
+status VM::run()
+{
+    if (finished)
+        return result;
+    if (options.debug)
+        return run_as<debug_policy>();
+    if (options.native && !options.profile && !options.sampler && !options.trace &&
+        !options.count_instructions)
+        return run_native();
+    return run_as<release_policy>();
+}
+
+
+// Runs the program with `Base` as the policy, profiling, sampling, tracing or counting
+// instructions if asked to
+template <typename Base>
+status VM::run_as()
+{
+    if (options.profile) {
+        profiling_policy<Base> policy;
+        policy.profile = options.profile;
+        return interpret(policy);
+    }
+    if (options.sampler) {
+        sampling_policy<Base> policy;
+        policy.sampler = options.sampler;
+        options.sampler->watch(&state.callstack);
+        return interpret(policy);
+    }
+    if (options.trace) {
+        tracing_policy<Base> policy;
+        policy.trace = options.trace;
+        status s = interpret(policy);
+        if (s == status::failed)
+            options.trace->fail();
+        else
+            options.trace->finish(state);
+        return s;
+    }
+    if (options.count_instructions) {
+        counting_policy<Base> policy;
+        status s = interpret(policy);
+        executed += policy.count;
+        return s;
+    }
+    Base policy;
+    return interpret(policy);
+}
+
+
+// VM::run_native
+// Runs the rest of the program as native code, on the same state the interpreter would use, or
+// in the interpreter if the code can't be translated
+// @ret - `halted` or `failed`
+status VM::run_native()
+{
+    if (!jit)
+        jit.reset(new Jit(*program, instrs.data()));
+    if (!jit->ok()) {
+        std::cerr << Warn() << "Could not generate native code, running in the VM" << std::endl;
+        options.native = false;
+        return run_as<release_policy>();
+    }
+    // Native code only returns once the program ended
+    jit->run(state, pc);
+    return finish(state.failed ? status::failed : status::halted);
+}
+
+
+// VM::step
+// Runs at most `n` instructions
+// @arg n - Number of instructions to run
+// @ret - `paused` if the program can go on, `halted` or `failed` otherwise
+status VM::step(uint64_t n)
+{
+    if (finished)
+        return result;
+    if (options.debug)
+        return step_as<debug_policy>(n);
+    return step_as<release_policy>(n);
+}
+
+
+// Runs at most `n` instructions with `Base` as the policy. They are always counted.
+template <typename Base>
+status VM::step_as(uint64_t n)
+{
+    stepping_policy<Base> policy;
+    policy.left = n;
+    status s = interpret(policy);
+    executed += n - policy.left;
+    return s;
+}
+
+
+// VM::instructions
+// @ret - Number of instructions run so far by `step`, and by `run` if they are counted
+uint64_t VM::instructions() const
+{
+    return executed;
+}
+
+
+// Ends the program, writing out whatever output is still buffered
+status VM::finish(status s)
+{
+    state.out.flush();
+    finished = true;
+    result = s;
+    return s;
+}
+
+
+// VM::interpret
+// Runs the instructions from `pc` until the program ends or the policy stops it
+template <typename Policy>
+status VM::interpret(Policy &policy)
+{
+    const Code &code = *program;
+    instr *const ins = instrs.data();
+    auto &in = state.in;
+    auto &out = state.out;
+    auto &stack = state.stack;
+    auto &callstack = state.callstack;
+    auto &reg = state.reg;
+    // Kept apart from `state` while interpreting, and synced with it when switching tiers or
+    // pausing
+    uint8_t flags = state.flags;
+    int8_t stdin_state = state.stdin_state;
 
     var a1, a2;
     var_type optype;
 
-    int8_t stdin_state = 0;
     int64_t integer_token;
     double floating_token;
 
-    size_t pc;
-    for (pc = code.entry_point; pc < code.size(); pc++) {
-        const auto op = code[pc].as_op();
+    bool tiering = Policy::tiering && this->tiering;
+    if (tiering && hits.empty())
+        hits.assign(code.size(), 0);
 
-        if (code[pc].get_type() != var_type::operation) {
-            std::cout << Error() << "VM tried to execute a non-operation at " << pc << std::endl;
-            return;
-        }
+    size_t pc = this->pc;
 
-        if (dtvm_args::debug) {
-            if (pc >= 2 && (code[pc-2].as_op() == op::ods || code[pc-2].as_op() == op::ofv))
-                std::cout << '\n';
-            if (dtvm_args::no_ansi_color_codes) {
-                std::cout << "DEBUG:\t";
-                display_line(std::cout, code, pc);
-                std::cout << std::endl;
-            } else {
-                std::cout << "\033[1;30;43m" << pc << ":\t";
-                display_line(std::cout, code, pc);
-                std::cout << "\033[0m" << std::endl;
+#ifdef DTVM_COMPUTED_GOTO
+    // Taking the address of a label is a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+    // Must follow the declaration order of `op`
+    static void *const dispatch_table[] = {
+        &&VM_TARGET(halt), &&VM_TARGET(noop),
+        &&VM_TARGET(mov), &&VM_TARGET(push), &&VM_TARGET(pop),
+        &&VM_TARGET(inc), &&VM_TARGET(dec), &&VM_TARGET(add), &&VM_TARGET(sub),
+        &&VM_TARGET(mul), &&VM_TARGET(div), &&VM_TARGET(mod),
+        &&VM_TARGET(cil), &&VM_TARGET(cfl),
+        &&VM_TARGET(ods), &&VM_TARGET(ofv), &&VM_TARGET(onl),
+        &&VM_TARGET(iiv), &&VM_TARGET(ifv), &&VM_TARGET(ipf),
+        &&VM_TARGET(cmp), &&VM_TARGET(cmpz),
+        &&VM_TARGET(jmp), &&VM_TARGET(jgt), &&VM_TARGET(jeq), &&VM_TARGET(jlt),
+        &&VM_TARGET(call), &&VM_TARGET(ret),
+        &&VM_TARGET(cilw),
+        &&VM_TARGET(upush), &&VM_TARGET(upop), &&VM_TARGET(ucall), &&VM_TARGET(uret),
+        &&VM_TARGET(inc_i), &&VM_TARGET(inc_f), &&VM_TARGET(dec_i), &&VM_TARGET(dec_f),
+        &&VM_TARGET(add_ii), &&VM_TARGET(add_ff), &&VM_TARGET(sub_ii), &&VM_TARGET(sub_ff),
+        &&VM_TARGET(mul_ii), &&VM_TARGET(mul_ff), &&VM_TARGET(div_ii), &&VM_TARGET(div_ff),
+        &&VM_TARGET(mod_ii),
+        &&VM_TARGET(cmp_ii), &&VM_TARGET(cmp_ff), &&VM_TARGET(cmpz_i), &&VM_TARGET(cmpz_f),
+        &&VM_TARGET(iinc), &&VM_TARGET(finc), &&VM_TARGET(idec), &&VM_TARGET(fdec),
+        &&VM_TARGET(iadd), &&VM_TARGET(fadd), &&VM_TARGET(isub), &&VM_TARGET(fsub),
+        &&VM_TARGET(imul), &&VM_TARGET(fmul), &&VM_TARGET(idiv), &&VM_TARGET(fdiv),
+        &&VM_TARGET(imod),
+        &&VM_TARGET(icmp), &&VM_TARGET(fcmp), &&VM_TARGET(icmpz), &&VM_TARGET(fcmpz),
+        &&VM_TARGET(icmp_jgt), &&VM_TARGET(icmp_jeq), &&VM_TARGET(icmp_jlt),
+        &&VM_TARGET(fcmp_jgt), &&VM_TARGET(fcmp_jeq), &&VM_TARGET(fcmp_jlt),
+        &&VM_TARGET(icmpz_jgt), &&VM_TARGET(icmpz_jeq), &&VM_TARGET(icmpz_jlt),
+        &&VM_TARGET(fcmpz_jgt), &&VM_TARGET(fcmpz_jeq), &&VM_TARGET(fcmpz_jlt),
+        &&VM_TARGET(iinc_icmp_jgt), &&VM_TARGET(iinc_icmp_jeq), &&VM_TARGET(iinc_icmp_jlt),
+        &&VM_TARGET(idec_icmp_jgt), &&VM_TARGET(idec_icmp_jeq), &&VM_TARGET(idec_icmp_jlt),
+    };
+    static_assert(sizeof(dispatch_table) / sizeof(*dispatch_table) ==
+                  static_cast<size_t>(op::idec_icmp_jlt) + 1, "dispatch_table is missing an op");
+
+    VM_DISPATCH();
+#else
+    for (;;) {
+        if (!policy.step(ins, code, pc, state))
+            goto pause;
+
+        switch (ins[pc].code) {
+#endif
+
+        VM_TARGET(halt):
+            return finish(status::halted);
+
+        VM_TARGET(noop):
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(mov):
+            reg[ins[pc].b] = reg[ins[pc].a];
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(push):
+            if (stack.full()) {
+                out.flush();
+                std::cerr << Error() << "Stack overflow at " << pc << std::endl;
+                return finish(status::failed);
             }
-        }
+            goto VM_LABEL(upush);
 
-        switch (op) {
-        case op::halt:
-            return;
+        VM_TARGET(upush):
+            stack.push(reg[ins[pc].a]);
+            pc += 1;
+            VM_DISPATCH();
 
-        case op::noop:
-            break;
+        VM_TARGET(pop):
+            if (stack.empty()) {
+                out.flush();
+                std::cerr << Error() << "`pop` in an empty stack at " << pc << std::endl;
+                return finish(status::failed);
+            }
+            goto VM_LABEL(upop);
 
-        case op::mov:
-            reg[code[pc+2].as_int()] = reg[code[pc+1].as_int()];
-            pc += 2;
-            break;
+        VM_TARGET(upop):
+            reg[ins[pc].a] = stack.pop();
+            pc += 1;
+            VM_DISPATCH();
 
-        case op::push:
-            stack.push(reg[code[pc+1].as_int()]);
+        VM_TARGET(inc):
+            if (reg[ins[pc].a].get_type() == var_type::integer)
+                VM_REWRITE(inc_i);
+            VM_REWRITE(inc_f);
+
+        VM_TARGET(inc_i):
+            if (reg[ins[pc].a].get_type() != var_type::integer)
+                VM_REWRITE(inc);
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() + 1;
             pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::pop:
-            reg[code[pc+1].as_int()] = stack.top();
-            stack.pop();
+        VM_TARGET(inc_f):
+            if (reg[ins[pc].a].get_type() != var_type::floating)
+                VM_REWRITE(inc);
+            reg[ins[pc].a] = reg[ins[pc].a].as_float() + 1;
             pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::inc:
-            a1 = reg[code[pc+1].as_int()];
-            optype = a1.get_type();
-            if (optype == var_type::integer)
-                reg[code[pc+1].as_int()] = reg[code[pc+1].as_int()].as_int() + 1;
-            else
-                reg[code[pc+1].as_int()] = reg[code[pc+1].as_int()].as_float() + 1;
+        VM_TARGET(dec):
+            if (reg[ins[pc].a].get_type() == var_type::integer)
+                VM_REWRITE(dec_i);
+            VM_REWRITE(dec_f);
+
+        VM_TARGET(dec_i):
+            if (reg[ins[pc].a].get_type() != var_type::integer)
+                VM_REWRITE(dec);
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() - 1;
             pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::dec:
-            a1 = reg[code[pc+1].as_int()];
-            optype = a1.get_type();
-            if (optype == var_type::integer)
-                reg[code[pc+1].as_int()] = reg[code[pc+1].as_int()].as_int() - 1;
-            else
-                reg[code[pc+1].as_int()] = reg[code[pc+1].as_int()].as_float() - 1;
+        VM_TARGET(dec_f):
+            if (reg[ins[pc].a].get_type() != var_type::floating)
+                VM_REWRITE(dec);
+            reg[ins[pc].a] = reg[ins[pc].a].as_float() - 1;
             pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::add:
-            a1 = reg[code[pc+1].as_int()];
-            a2 = reg[code[pc+2].as_int()];
-            optype = a1.get_type();
-            if (optype != a2.get_type()) {
+        VM_TARGET(add):
+            optype = reg[ins[pc].a].get_type();
+            if (optype != reg[ins[pc].b].get_type()) {
+                out.flush();
                 std::cerr << Error() << "Type mismatch at " << pc << std::endl;
-                return;
-            }
-            if (optype == var_type::integer) {
-                reg[code[pc+2].as_int()] = var(a2.as_int() + a1.as_int());
-            } else {
-                reg[code[pc+2].as_int()] = var(a2.as_float() + a1.as_float());
+                return finish(status::failed);
             }
-            // Implicitly doing nothing when optype is `op` (shouldn't happen).
-            pc += 2;
-            break;
-
-        case op::sub:
-            a1 = reg[code[pc+1].as_int()];
-            a2 = reg[code[pc+2].as_int()];
-            optype = a1.get_type();
-            if (optype != a2.get_type()) {
+            if (optype == var_type::integer)
+                VM_REWRITE(add_ii);
+            VM_REWRITE(add_ff);
+
+        VM_TARGET(add_ii):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::integer || a2.get_type() != var_type::integer)
+                VM_REWRITE(add);
+            reg[ins[pc].b] = var(a2.as_int() + a1.as_int());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(add_ff):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::floating || a2.get_type() != var_type::floating)
+                VM_REWRITE(add);
+            reg[ins[pc].b] = var(a2.as_float() + a1.as_float());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(sub):
+            optype = reg[ins[pc].a].get_type();
+            if (optype != reg[ins[pc].b].get_type()) {
+                out.flush();
                 std::cerr << Error() << "Type mismatch at " << pc << std::endl;
-                return;
-            }
-            if (optype == var_type::integer) {
-                reg[code[pc+2].as_int()] = var(a2.as_int() - a1.as_int());
-            } else {
-                reg[code[pc+2].as_int()] = var(a2.as_float() - a1.as_float());
+                return finish(status::failed);
             }
-            // Implicitly doing nothing when optype is `op` (shouldn't happen).
-            pc += 2;
-            break;
-
-        case op::mul:
-            a1 = reg[code[pc+1].as_int()];
-            a2 = reg[code[pc+2].as_int()];
-            optype = a1.get_type();
-            if (optype != a2.get_type()) {
+            if (optype == var_type::integer)
+                VM_REWRITE(sub_ii);
+            VM_REWRITE(sub_ff);
+
+        VM_TARGET(sub_ii):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::integer || a2.get_type() != var_type::integer)
+                VM_REWRITE(sub);
+            reg[ins[pc].b] = var(a2.as_int() - a1.as_int());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(sub_ff):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::floating || a2.get_type() != var_type::floating)
+                VM_REWRITE(sub);
+            reg[ins[pc].b] = var(a2.as_float() - a1.as_float());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(mul):
+            optype = reg[ins[pc].a].get_type();
+            if (optype != reg[ins[pc].b].get_type()) {
+                out.flush();
                 std::cerr << Error() << "Type mismatch at " << pc << std::endl;
-                return;
-            }
-            if (optype == var_type::integer) {
-                reg[code[pc+2].as_int()] = var(a2.as_int() * a1.as_int());
-            } else {
-                reg[code[pc+2].as_int()] = var(a2.as_float() * a1.as_float());
+                return finish(status::failed);
             }
-            // Implicitly doing nothing when optype is `op` (shouldn't happen).
-            pc += 2;
-            break;
-
-        case op::div:
-            a1 = reg[code[pc+1].as_int()];
-            a2 = reg[code[pc+2].as_int()];
-            optype = a1.get_type();
-            if (optype != a2.get_type()) {
+            if (optype == var_type::integer)
+                VM_REWRITE(mul_ii);
+            VM_REWRITE(mul_ff);
+
+        VM_TARGET(mul_ii):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::integer || a2.get_type() != var_type::integer)
+                VM_REWRITE(mul);
+            reg[ins[pc].b] = var(a2.as_int() * a1.as_int());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(mul_ff):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::floating || a2.get_type() != var_type::floating)
+                VM_REWRITE(mul);
+            reg[ins[pc].b] = var(a2.as_float() * a1.as_float());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(div):
+            optype = reg[ins[pc].a].get_type();
+            if (optype != reg[ins[pc].b].get_type()) {
+                out.flush();
                 std::cerr << Error() << "Type mismatch at " << pc << std::endl;
-                return;
-            }
-            if (optype == var_type::integer) {
-                reg[code[pc+2].as_int()] = var(a2.as_int() / a1.as_int());
-            } else {
-                reg[code[pc+2].as_int()] = var(a2.as_float() / a1.as_float());
+                return finish(status::failed);
             }
-            // Implicitly doing nothing when optype is `op` (shouldn't happen).
-            pc += 2;
-            break;
-
-        case op::mod:
-            a1 = reg[code[pc+1].as_int()];
-            a2 = reg[code[pc+2].as_int()];
-            optype = a1.get_type();
-            if (optype != a2.get_type()) {
+            if (optype == var_type::integer)
+                VM_REWRITE(div_ii);
+            VM_REWRITE(div_ff);
+
+        VM_TARGET(div_ii):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::integer || a2.get_type() != var_type::integer)
+                VM_REWRITE(div);
+            reg[ins[pc].b] = var(a2.as_int() / a1.as_int());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(div_ff):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::floating || a2.get_type() != var_type::floating)
+                VM_REWRITE(div);
+            reg[ins[pc].b] = var(a2.as_float() / a1.as_float());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(mod):
+            optype = reg[ins[pc].a].get_type();
+            if (optype != reg[ins[pc].b].get_type()) {
+                out.flush();
                 std::cerr << Error() << "Type mismatch at " << pc << std::endl;
-                return;
+                return finish(status::failed);
             }
             if (optype != var_type::integer) {
+                out.flush();
                 std::cerr << Error() << "Invalid type at " << pc << std::endl;
-                return;
+                return finish(status::failed);
             }
-            reg[code[pc+2].as_int()] = var(a2.as_int() % a1.as_int());
-            pc += 2;
-            break;
+            VM_REWRITE(mod_ii);
 
-        case op::cil:
-            reg[code[pc+2].as_int()] = var(code[pc+1].as_int());
-            pc += 2;
-            break;
+        VM_TARGET(mod_ii):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::integer || a2.get_type() != var_type::integer)
+                VM_REWRITE(mod);
+            reg[ins[pc].b] = var(a2.as_int() % a1.as_int());
+            pc += 1;
+            VM_DISPATCH();
 
-        case op::cfl:
-            reg[code[pc+2].as_int()] = var(code[pc+1].as_float());
-            pc += 2;
-            break;
+        VM_TARGET(cil):
+            reg[ins[pc].b] = var(ins[pc].imm);
+            pc += 1;
+            VM_DISPATCH();
 
-        case op::ods:
-            std::cout << code.data[code[pc+1].as_int()];
+        VM_TARGET(cfl):
+            reg[ins[pc].b] = code.consts[ins[pc].imm];
             pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::ofv:
-            std::cout << reg[code[pc+1].as_int()] << ' ';
+        VM_TARGET(cilw):
+            reg[ins[pc].b] = code.consts[ins[pc].imm];
             pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::onl:
-            std::cout << std::endl;
-            break;
+        VM_TARGET(ods):
+            out.write(code.data[ins[pc].imm]);
+            pc += 1;
+            VM_DISPATCH();
 
-        case op::iiv:
-            std::cin >> integer_token;
-            if (std::cin.fail()) {
-                stdin_state = 1;
-            } else {
+        VM_TARGET(ofv):
+            out.write(reg[ins[pc].a]);
+            out.put(' ');
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(onl):
+            out.newline();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(iiv):
+            out.before_input();
+            if (in.integer(integer_token)) {
                 stdin_state = 0;
-                reg[code[pc+1].as_int()] = integer_token;
+                reg[ins[pc].a] = integer_token;
+            } else {
+                stdin_state = 1;
             }
-            std::cin.clear();
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
             pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::ifv:
-            std::cin >> floating_token;
-            if (std::cin.fail()) {
-                stdin_state = 1;
-            } else {
+        VM_TARGET(ifv):
+            out.before_input();
+            if (in.floating(floating_token)) {
                 stdin_state = 0;
-                reg[code[pc+1].as_int()] = floating_token;
+                reg[ins[pc].a] = floating_token;
+            } else {
+                stdin_state = 1;
             }
-            std::cin.clear();
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
             pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::ipf:
-            reg[code[pc+1].as_int()] = int64_t(stdin_state);
+        VM_TARGET(ipf):
+            reg[ins[pc].a] = int64_t(stdin_state);
             pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::cmp:
-            a1 = reg[code[pc+1].as_int()];
-            a2 = reg[code[pc+2].as_int()];
-            optype = a1.get_type();
-            if (optype != a2.get_type()) {
+        VM_TARGET(cmp):
+            optype = reg[ins[pc].a].get_type();
+            if (optype != reg[ins[pc].b].get_type()) {
+                out.flush();
                 std::cerr << Error() << "Type mismatch at " << pc << std::endl;
-                return;
-            }
-            if (optype == var_type::integer) {
-                const auto v1 = a1.as_int();
-                const auto v2 = a2.as_int();
-                if (v1 < v2) {
-                    flags = VM_FLAG_LT;
-                } else if (v1 == v2) {
-                    flags = VM_FLAG_EQ;
-                } else {
-                    flags = VM_FLAG_GT;
-                }
-            } else {
-                const auto v1 = a1.as_float();
-                const auto v2 = a2.as_float();
-                if (v1 < v2) {
-                    flags = VM_FLAG_LT;
-                } else if (v1 == v2) {
-                    flags = VM_FLAG_EQ;
-                } else {
-                    flags = VM_FLAG_GT;
-                }
+                return finish(status::failed);
             }
-            // Implicitly doing nothing when optype is `op` (shouldn't happen).
-            pc += 2;
-            break;
-
-        case op::cmpz:
-            a1 = reg[code[pc+1].as_int()];
-            optype = a1.get_type();
-            if (optype == var_type::integer) {
-                const auto v1 = a1.as_int();
-                if (v1 < 0) {
-                    flags = VM_FLAG_LT;
-                } else if (v1 == 0) {
-                    flags = VM_FLAG_EQ;
-                } else {
-                    flags = VM_FLAG_GT;
-                }
-            } else {
-                const auto v1 = a1.as_float();
-                if (v1 < 0) {
-                    flags = VM_FLAG_LT;
-                } else if (v1 == 0) {
-                    flags = VM_FLAG_EQ;
-                } else {
-                    flags = VM_FLAG_GT;
-                }
-            }
-            // Implicitly doing nothing when optype is `op` (shouldn't happen).
+            if (optype == var_type::integer)
+                VM_REWRITE(cmp_ii);
+            VM_REWRITE(cmp_ff);
+
+        VM_TARGET(cmp_ii):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::integer || a2.get_type() != var_type::integer)
+                VM_REWRITE(cmp);
+            flags = compare(a1.as_int(), a2.as_int());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(cmp_ff):
+            a1 = reg[ins[pc].a];
+            a2 = reg[ins[pc].b];
+            if (a1.get_type() != var_type::floating || a2.get_type() != var_type::floating)
+                VM_REWRITE(cmp);
+            flags = compare(a1.as_float(), a2.as_float());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(cmpz):
+            if (reg[ins[pc].a].get_type() == var_type::integer)
+                VM_REWRITE(cmpz_i);
+            VM_REWRITE(cmpz_f);
+
+        VM_TARGET(cmpz_i):
+            a1 = reg[ins[pc].a];
+            if (a1.get_type() != var_type::integer)
+                VM_REWRITE(cmpz);
+            flags = compare(a1.as_int(), int64_t(0));
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(cmpz_f):
+            a1 = reg[ins[pc].a];
+            if (a1.get_type() != var_type::floating)
+                VM_REWRITE(cmpz);
+            flags = compare(a1.as_float(), 0.0);
+            pc += 1;
+            VM_DISPATCH();
+
+        // Statically typed instructions never check types
+
+        VM_TARGET(iinc):
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() + 1;
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(finc):
+            reg[ins[pc].a] = reg[ins[pc].a].as_float() + 1;
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(idec):
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() - 1;
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(fdec):
+            reg[ins[pc].a] = reg[ins[pc].a].as_float() - 1;
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(iadd):
+            reg[ins[pc].b] = reg[ins[pc].b].as_int() + reg[ins[pc].a].as_int();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(fadd):
+            reg[ins[pc].b] = reg[ins[pc].b].as_float() + reg[ins[pc].a].as_float();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(isub):
+            reg[ins[pc].b] = reg[ins[pc].b].as_int() - reg[ins[pc].a].as_int();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(fsub):
+            reg[ins[pc].b] = reg[ins[pc].b].as_float() - reg[ins[pc].a].as_float();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(imul):
+            reg[ins[pc].b] = reg[ins[pc].b].as_int() * reg[ins[pc].a].as_int();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(fmul):
+            reg[ins[pc].b] = reg[ins[pc].b].as_float() * reg[ins[pc].a].as_float();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(idiv):
+            reg[ins[pc].b] = reg[ins[pc].b].as_int() / reg[ins[pc].a].as_int();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(fdiv):
+            reg[ins[pc].b] = reg[ins[pc].b].as_float() / reg[ins[pc].a].as_float();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(imod):
+            reg[ins[pc].b] = reg[ins[pc].b].as_int() % reg[ins[pc].a].as_int();
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(icmp):
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(fcmp):
+            flags = compare(reg[ins[pc].a].as_float(), reg[ins[pc].b].as_float());
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(icmpz):
+            flags = compare(reg[ins[pc].a].as_int(), int64_t(0));
+            pc += 1;
+            VM_DISPATCH();
+
+        VM_TARGET(fcmpz):
+            flags = compare(reg[ins[pc].a].as_float(), 0.0);
             pc += 1;
-            break;
+            VM_DISPATCH();
+
+        // Superinstructions still update the flags, since later jumps may read them. The jump
+        // they were fused with is skipped when falling through.
+
+        VM_TARGET(icmp_jgt):
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            if (flags & VM_FLAG_GT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(icmp_jeq):
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            if (flags & VM_FLAG_EQ)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(icmp_jlt):
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            if (flags & VM_FLAG_LT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(fcmp_jgt):
+            flags = compare(reg[ins[pc].a].as_float(), reg[ins[pc].b].as_float());
+            if (flags & VM_FLAG_GT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(fcmp_jeq):
+            flags = compare(reg[ins[pc].a].as_float(), reg[ins[pc].b].as_float());
+            if (flags & VM_FLAG_EQ)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
 
-        case op::jmp:
-            pc = code[pc+1].as_int() - 1; // - 1 Because of increment
-            break;
+        VM_TARGET(fcmp_jlt):
+            flags = compare(reg[ins[pc].a].as_float(), reg[ins[pc].b].as_float());
+            if (flags & VM_FLAG_LT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
 
-        case op::jgt:
+        VM_TARGET(icmpz_jgt):
+            flags = compare(reg[ins[pc].a].as_int(), int64_t(0));
             if (flags & VM_FLAG_GT)
-                pc = code[pc+1].as_int() - 1; // - 1 Because of increment
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(icmpz_jeq):
+            flags = compare(reg[ins[pc].a].as_int(), int64_t(0));
+            if (flags & VM_FLAG_EQ)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(icmpz_jlt):
+            flags = compare(reg[ins[pc].a].as_int(), int64_t(0));
+            if (flags & VM_FLAG_LT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(fcmpz_jgt):
+            flags = compare(reg[ins[pc].a].as_float(), 0.0);
+            if (flags & VM_FLAG_GT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(fcmpz_jeq):
+            flags = compare(reg[ins[pc].a].as_float(), 0.0);
+            if (flags & VM_FLAG_EQ)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(fcmpz_jlt):
+            flags = compare(reg[ins[pc].a].as_float(), 0.0);
+            if (flags & VM_FLAG_LT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 2;
+            VM_DISPATCH();
+
+        VM_TARGET(iinc_icmp_jgt):
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() + 1;
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            if (flags & VM_FLAG_GT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 3;
+            VM_DISPATCH();
+
+        VM_TARGET(iinc_icmp_jeq):
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() + 1;
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            if (flags & VM_FLAG_EQ)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 3;
+            VM_DISPATCH();
+
+        VM_TARGET(iinc_icmp_jlt):
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() + 1;
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            if (flags & VM_FLAG_LT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 3;
+            VM_DISPATCH();
+
+        VM_TARGET(idec_icmp_jgt):
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() - 1;
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            if (flags & VM_FLAG_GT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 3;
+            VM_DISPATCH();
+
+        VM_TARGET(idec_icmp_jeq):
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() - 1;
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            if (flags & VM_FLAG_EQ)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 3;
+            VM_DISPATCH();
+
+        VM_TARGET(idec_icmp_jlt):
+            reg[ins[pc].a] = reg[ins[pc].a].as_int() - 1;
+            flags = compare(reg[ins[pc].a].as_int(), reg[ins[pc].b].as_int());
+            if (flags & VM_FLAG_LT)
+                VM_JUMP(ins[pc].imm);
+            else
+                pc += 3;
+            VM_DISPATCH();
+
+        VM_TARGET(jmp):
+            VM_JUMP(ins[pc].imm);
+            VM_DISPATCH();
+
+        VM_TARGET(jgt):
+            if (flags & VM_FLAG_GT)
+                VM_JUMP(ins[pc].imm);
             else
                 pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::jeq:
+        VM_TARGET(jeq):
             if (flags & VM_FLAG_EQ)
-                pc = code[pc+1].as_int() - 1; // - 1 Because of increment
+                VM_JUMP(ins[pc].imm);
             else
                 pc += 1;
-            break;
+            VM_DISPATCH();
 
-        case op::jlt:
+        VM_TARGET(jlt):
             if (flags & VM_FLAG_LT)
-                pc = code[pc+1].as_int() - 1; // - 1 Because of increment
+                VM_JUMP(ins[pc].imm);
             else
                 pc += 1;
-            break;
+            VM_DISPATCH();
+
+        VM_TARGET(call):
+            if (callstack.full()) {
+                out.flush();
+                std::cerr << Error() << "Callstack overflow at " << pc << std::endl;
+                return finish(status::failed);
+            }
+            goto VM_LABEL(ucall);
 
-        case op::call:
+        VM_TARGET(ucall):
             callstack.push(pc + 1);
-            pc = code[pc+1].as_int() - 1; // - 1 Because of increment
-            break;
+            if (tiering && ++hits[ins[pc].imm] == tier_up_threshold) {
+                pc = ins[pc].imm;
+                goto tier_up;
+            }
+            pc = ins[pc].imm;
+            VM_DISPATCH();
 
-        case op::ret:
+        VM_TARGET(ret):
             if (callstack.empty()) {
+                out.flush();
                 std::cerr << Error() << "`ret` in an empty callstack at " << pc << std::endl;
-                return;
+                return finish(status::failed);
             }
-            pc = callstack.top();
-            callstack.pop();
-            break;
+            goto VM_LABEL(uret);
+
+        VM_TARGET(uret):
+            pc = callstack.pop();
+            VM_DISPATCH();
+
+        // Not an instruction: reached from VM_JUMP and `call` when `pc` got hot
+        tier_up:
+            if (!jit)
+                jit.reset(new Jit(code, instrs.data()));
+            if (!jit->ok()) {
+                tiering = this->tiering = false;
+                VM_DISPATCH();
+            }
+            state.flags = flags;
+            state.stdin_state = stdin_state;
+            {
+                int64_t resume = jit->run(state, pc);
+                if (resume < 0)
+                    return finish(state.failed ? status::failed : status::halted);
+                pc = resume;
+            }
+            flags = state.flags;
+            stdin_state = state.stdin_state;
+            VM_DISPATCH();
+
+        // Not an instruction: reached from VM_DISPATCH when the policy stops the loop
+        pause:
+            state.flags = flags;
+            state.stdin_state = stdin_state;
+            this->pc = pc;
+            return status::paused;
+
+#ifdef DTVM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#else
         }
     }
+#endif
+}
+
 }
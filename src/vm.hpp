@@ -3,7 +3,107 @@
 
 #pragma once
 
+#include <cinttypes>
+#include <memory>
+#include <vector>
+
 #include "code.hpp"
+#include "jit.hpp"
+#include "output.hpp"
+#include "profile.hpp"
+#include "sampler.hpp"
+#include "state.hpp"
+#include "trace.hpp"
+
+
+namespace dtvm {
+
+// How a VM runs its program
+struct Options {
+	// Number of registers. Raised to however many the code uses.
+	int num_regs = 8;
+	// Prints every instruction as it runs
+	bool debug = false;
+	// Moves hot code to native code while running
+	bool tiering = true;
+	// Translates the whole program to native code and runs it there, unless it is being debugged,
+	// profiled, sampled, traced or counted. Falls back to the interpreter where that can't be done.
+	bool native = false;
+	// Capacity of the stack and of the callstack. Raised to however deep the code is proven to
+	// get.
+	size_t stack_size = size_t(1) << 20;
+	// When program output is written out
+	flush_policy flush = flush_policy::line;
+	// Where input comes from and output goes to, instead of stdin and stdout. They must outlive
+	// the VM, and can't be shared by VMs running at the same time.
+	InputSource *input = nullptr;
+	OutputSink *output = nullptr;
+	// Counts the instructions `run` runs, which keeps everything in the interpreter
+	bool count_instructions = false;
+	// Profiles what `run` runs into `profile`, if set, which also keeps everything in the
+	// interpreter. It must be made for the same code, and outlive the VM.
+	Profile *profile = nullptr;
+	// Publishes every instruction `run` runs to `sampler`, if set, which also keeps everything in
+	// the interpreter. It must be made for the same code, and outlive the VM.
+	Sampler *sampler = nullptr;
+	// Records every step `run` runs in `trace`, if set, which also keeps everything in the
+	// interpreter. It must be made for the same code, and outlive the VM.
+	Trace *trace = nullptr;
+};
+
+// Why `run` or `step` returned
+enum class status {
+	// The program ran `halt`
+	halted,
+	// `step` ran as many instructions as it was asked to
+	paused,
+	// The program stopped on an error, which was reported on stderr
+	failed,
+};
+
+
+// A program being run. The code is shared and never written to, so any number of VMs can run the
+// same code. Registers, stacks, flags, I/O buffers and the instructions rewritten while running
+// belong to the VM, which can run the program again after `reset`.
+class VM {
+private:
+	std::shared_ptr<const Code> program;
+	Options options;
+	// Copy of the instructions, which quickening rewrites as the program runs
+	std::vector<instr> instrs;
+	vm_state state;
+	// Index of the next instruction to run
+	size_t pc;
+	// Set once the program halted or failed
+	bool finished;
+	status result;
+	uint64_t executed;
+
+	// Times each instruction was reached by a backward jump or a call
+	std::vector<uint32_t> hits;
+	std::unique_ptr<Jit> jit;
+	bool tiering;
+
+	template <typename Policy>
+	status interpret(Policy &policy);
+	template <typename Base>
+	status run_as();
+	template <typename Base>
+	status step_as(uint64_t n);
+	status run_native();
+	status finish(status s);
+
+public:
+	VM(std::shared_ptr<const Code> program, const Options &options);
+
+	VM(const VM&) = delete;
+	VM &operator=(const VM&) = delete;
 
+	status run();
+	status step(uint64_t n);
+	void reset();
+	void reset(InputSource *input, OutputSink *output);
+	uint64_t instructions() const;
+};
 
-void execute(Code code);
+}